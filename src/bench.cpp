@@ -0,0 +1,1684 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include <benchmark.h>
+#include <cpu.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "simpleocv.h"
+#include "YoloV7.h"
+#include "embedded_model.h"
+#include "prefork_server.h"
+#include "model_registry.h"
+#include "preprocess.h"
+#include "image_loader.h"
+#include "tiling.h"
+#include "frame_pipeline.h"
+#include "decoder.h"
+#include "proposals.h"
+
+using namespace Yolo;
+
+/// Minimum, maximum and average of a series of measurements in ms
+struct Stats {
+    double min = DBL_MAX;
+    double max = 0;
+    double sum = 0;
+    double sum_sq = 0;
+    int count = 0;
+
+    void add(double t)
+    {
+        min = std::min(min, t);
+        max = std::max(max, t);
+        sum += t;
+        sum_sq += t * t;
+        count++;
+    }
+
+    double avg() const
+    {
+        return count ? sum / count : 0;
+    }
+
+    double stddev() const
+    {
+        return count ? sqrt(std::max(sum_sq / count - avg() * avg(), 0.0)) : 0;
+    }
+};
+
+static void print_stats(const char* name, const Stats& stats)
+{
+    fprintf(stdout, "%-24s min = %9.2f ms  max = %9.2f ms  avg = %9.2f ms  (n = %d)\n",
+            name, stats.min, stats.max, stats.avg(), stats.count);
+}
+
+static cv::Mat load_image(const char* imagepath)
+{
+    cv::Mat m = cv::imread(imagepath, 1);
+    if (m.empty())
+    {
+        fprintf(stderr, "cv::imread %s failed\n", imagepath);
+    }
+    return m;
+}
+
+/// Cold versus warm latency of `YoloV7::detect`
+/// cold: construct, `init` and first `detect`, as done per call before the network was kept loaded
+/// warm: `detect` on an already initialized and warmed up object
+static int bench_latency(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: latency [imagepath] [loops=10]\n");
+        return -1;
+    }
+
+    cv::Mat m = load_image(argv[0]);
+    if (m.empty())
+        return -1;
+
+    const int loops = argc > 1 ? atoi(argv[1]) : 10;
+
+    Stats init_stats, first_stats, cold_stats, warm_stats;
+    std::vector<Object> objects;
+
+    // cold calls, a fresh object per call
+    for (int i = 0; i < loops; i++)
+    {
+        double start = ncnn::get_current_time();
+
+        YoloV7 yolov7;
+        if (yolov7.init())
+            return -1;
+
+        double loaded = ncnn::get_current_time();
+
+        if (yolov7.detect(m, objects))
+            return -1;
+
+        double end = ncnn::get_current_time();
+
+        init_stats.add(loaded - start);
+        first_stats.add(end - loaded);
+        cold_stats.add(end - start);
+    }
+
+    // warm calls, one object for all calls
+    YoloV7 yolov7;
+    if (yolov7.init())
+        return -1;
+
+    yolov7.detect(m, objects);
+
+    for (int i = 0; i < loops; i++)
+    {
+        double start = ncnn::get_current_time();
+        yolov7.detect(m, objects);
+        double end = ncnn::get_current_time();
+
+        warm_stats.add(end - start);
+    }
+
+    print_stats("init", init_stats);
+    print_stats("first detect", first_stats);
+    print_stats("cold (init + detect)", cold_stats);
+    print_stats("warm detect", warm_stats);
+
+    return 0;
+}
+
+/// Resident memory of the calling process in kB, read from /proc/self/status
+struct MemoryUsage {
+    long rss = 0;
+    long rss_anon = 0;
+    long rss_file = 0;
+
+    static MemoryUsage current()
+    {
+        MemoryUsage usage;
+
+        FILE* fp = fopen("/proc/self/status", "r");
+        if (!fp)
+            return usage;
+
+        char line[256];
+        while (fgets(line, sizeof(line), fp))
+        {
+            sscanf(line, "VmRSS: %ld", &usage.rss);
+            sscanf(line, "RssAnon: %ld", &usage.rss_anon);
+            sscanf(line, "RssFile: %ld", &usage.rss_file);
+        }
+
+        fclose(fp);
+
+        return usage;
+    }
+};
+
+/// Runs `f` in a forked child and passes its trivially copyable result back through a pipe,
+/// so that every measurement starts from the same clean process state
+template<typename T, typename F>
+static int run_in_child(F f, T& result)
+{
+    int pipefd[2];
+    if (pipe(pipefd))
+        return -1;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        close(pipefd[0]);
+
+        T child_result{};
+        int ret = f(child_result);
+
+        if (write(pipefd[1], &child_result, sizeof(T)) != sizeof(T))
+            ret = -1;
+
+        close(pipefd[1]);
+        _exit(ret ? 1 : 0);
+    }
+
+    close(pipefd[1]);
+
+    bool ok = read(pipefd[0], &result, sizeof(T)) == sizeof(T);
+    close(pipefd[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/// Load time and resident memory of `init` with stdio and mmap weight loading
+static int bench_load(int argc, char** argv)
+{
+    const int loops = argc > 0 ? atoi(argv[0]) : 5;
+
+    struct Result {
+        double time;
+        MemoryUsage before;
+        MemoryUsage after;
+    };
+
+    for (int use_mmap = 0; use_mmap < 2; use_mmap++)
+    {
+        Stats load_stats;
+        Result result{};
+
+        for (int i = 0; i < loops; i++)
+        {
+            auto load = [use_mmap](Result& r) {
+                r.before = MemoryUsage::current();
+
+                double start = ncnn::get_current_time();
+
+                YoloV7 yolov7;
+                int ret = yolov7.init(use_mmap);
+
+                r.time = ncnn::get_current_time() - start;
+                r.after = MemoryUsage::current();
+
+                return ret;
+            };
+
+            if (run_in_child(load, result))
+                return -1;
+
+            load_stats.add(result.time);
+        }
+
+        print_stats(use_mmap ? "init (mmap)" : "init (stdio)", load_stats);
+        fprintf(stdout, "%-24s rss = %7ld kB  anon = %7ld kB  file = %7ld kB\n", "",
+                result.after.rss - result.before.rss, result.after.rss_anon - result.before.rss_anon,
+                result.after.rss_file - result.before.rss_file);
+    }
+
+    return 0;
+}
+
+/// Time to first detection of a fresh process, from constructing the detector to the first result,
+/// for the param and bin files, a bundle file and the bundle embedded into the executable
+static int bench_startup(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: startup [imagepath] [bundlepath] [loops=5]\n");
+        return -1;
+    }
+
+    cv::Mat m = load_image(argv[0]);
+    if (m.empty())
+        return -1;
+
+    const char* bundlepath = argc > 1 ? argv[1] : nullptr;
+    const int loops = argc > 2 ? atoi(argv[2]) : 5;
+
+    enum Source { FILES, BUNDLE, EMBEDDED };
+    const char* names[] = {"param + bin", "bundle file", "embedded bundle"};
+
+    for (int source = FILES; source <= EMBEDDED; source++)
+    {
+        if (source == BUNDLE && !bundlepath)
+            continue;
+#if !YOLOV7_EMBEDDED_MODEL
+        if (source == EMBEDDED)
+            continue;
+#endif
+
+        Stats init_stats, ttfd_stats;
+
+        for (int i = 0; i < loops; i++)
+        {
+            auto first_detection = [&](double (&t)[2]) {
+                double start = ncnn::get_current_time();
+
+#if YOLOV7_EMBEDDED_MODEL
+                YoloV7 yolov7 = source == EMBEDDED ? YoloV7(yolov7_embedded_model, embedded_model_size())
+                              : source == BUNDLE ? YoloV7(bundlepath) : YoloV7();
+#else
+                YoloV7 yolov7 = source == BUNDLE ? YoloV7(bundlepath) : YoloV7();
+#endif
+                if (yolov7.init())
+                    return -1;
+
+                t[0] = ncnn::get_current_time() - start;
+
+                std::vector<Object> objects;
+                if (yolov7.detect(m, objects))
+                    return -1;
+
+                t[1] = ncnn::get_current_time() - start;
+
+                return 0;
+            };
+
+            double t[2];
+            if (run_in_child(first_detection, t))
+                return -1;
+
+            init_stats.add(t[0]);
+            ttfd_stats.add(t[1]);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s init", names[source]);
+        print_stats(name, init_stats);
+        snprintf(name, sizeof(name), "%s ttfd", names[source]);
+        print_stats(name, ttfd_stats);
+    }
+
+    return 0;
+}
+
+/// Startup broken down into param parse, weight load, pipeline creation, first and steady-state inference
+static int bench_phases(int argc, char** argv)
+{
+    const char* bundlepath = argc > 0 && strcmp(argv[0], "-") != 0 ? argv[0] : nullptr;
+    const int warmup_runs = argc > 1 ? atoi(argv[1]) : 5;
+    const int w = argc > 2 ? atoi(argv[2]) : 0;
+    const int h = argc > 3 ? atoi(argv[3]) : 0;
+
+    double start = ncnn::get_current_time();
+
+    YoloV7 yolov7 = bundlepath ? YoloV7(bundlepath) : YoloV7();
+    if (yolov7.init() || yolov7.warmup(warmup_runs, w, h))
+        return -1;
+
+    double total = ncnn::get_current_time() - start;
+
+    const StartupTimes& times = yolov7.startup_times();
+    fprintf(stdout, "%-24s %9.2f ms\n", "param parse", times.param_parse);
+    fprintf(stdout, "%-24s %9.2f ms\n", "weight load", times.weight_load);
+    fprintf(stdout, "%-24s %9.2f ms\n", "pipeline creation", times.pipeline_creation);
+    fprintf(stdout, "%-24s %9.2f ms\n", "first inference", times.first_inference);
+    fprintf(stdout, "%-24s %9.2f ms\n", "steady inference", times.steady_inference);
+    fprintf(stdout, "%-24s %9.2f ms\n", "boot to ready", times.param_parse + times.weight_load + times.pipeline_creation + times.first_inference);
+    fprintf(stdout, "%-24s %9.2f ms\n", "total incl. warmup", total);
+
+    return 0;
+}
+
+/// Latency of detections running concurrently with a model hot swap, compared to detections without a swap
+static int bench_swap(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: swap [imagepath] [frames=20]\n");
+        return -1;
+    }
+
+    cv::Mat m = load_image(argv[0]);
+    if (m.empty())
+        return -1;
+
+    const int frames = argc > 1 ? atoi(argv[1]) : 20;
+
+    YoloV7 yolov7;
+    if (yolov7.init() || yolov7.warmup(1))
+        return -1;
+
+    std::atomic<bool> swapping(false);
+    std::atomic<bool> done(false);
+    Stats idle_stats, swap_stats;
+
+    // the detection thread keeps running frames until the swap has finished and enough frames were seen
+    std::thread detection([&]() {
+        std::vector<Object> objects;
+        for (int i = 0; !done || i < frames; i++)
+        {
+            bool during_swap = swapping;
+
+            double start = ncnn::get_current_time();
+            yolov7.detect(m, objects);
+            double t = ncnn::get_current_time() - start;
+
+            // a frame counts as concurrent if the swap was running at its start or end
+            if (during_swap || swapping)
+                swap_stats.add(t);
+            else
+                idle_stats.add(t);
+        }
+    });
+
+    // let a few frames pass before swapping in the same model files again
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    swapping = true;
+    double start = ncnn::get_current_time();
+    int ret = yolov7.swap_model_async("../resources/yolov7_tiny.torchscript.ncnn.param", "../resources/yolov7_tiny.torchscript.ncnn.bin").get();
+    double swap_time = ncnn::get_current_time() - start;
+    swapping = false;
+    done = true;
+
+    detection.join();
+
+    if (ret)
+        return -1;
+
+    fprintf(stdout, "%-24s %9.2f ms\n", "swap (load + warmup)", swap_time);
+    print_stats("detect without swap", idle_stats);
+    print_stats("detect during swap", swap_stats);
+
+    return 0;
+}
+
+static void print_smaps(const char* name, const SmapsUsage& usage)
+{
+    fprintf(stdout, "%-24s rss = %7ld kB  pss = %7ld kB  shared = %7ld kB  private = %7ld kB\n", name,
+            usage.rss, usage.pss, usage.shared_clean + usage.shared_dirty, usage.private_clean + usage.private_dirty);
+}
+
+/// Worker spawn latency, per-worker shared and private memory and throughput of the prefork server
+static int bench_prefork(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: prefork [imagepath] [workers=2] [frames=10]\n");
+        return -1;
+    }
+
+    cv::Mat m = load_image(argv[0]);
+    if (m.empty())
+        return -1;
+
+    const int num_workers = argc > 1 ? atoi(argv[1]) : 2;
+    const int frames = argc > 2 ? atoi(argv[2]) : 10;
+
+    YoloV7 yolov7;
+    if (yolov7.init())
+        return -1;
+
+    PreforkServer server(yolov7);
+    if (server.start(num_workers))
+        return -1;
+
+    // frames are queued on all workers first, then collected in order
+    double start = ncnn::get_current_time();
+
+    std::vector<Object> objects;
+    for (int i = 0; i < frames; i++)
+    {
+        if (server.submit(i % num_workers, m))
+            return -1;
+    }
+    for (int i = 0; i < frames; i++)
+    {
+        if (server.receive(i % num_workers, objects))
+            return -1;
+    }
+
+    double elapsed = ncnn::get_current_time() - start;
+
+    print_smaps("parent", SmapsUsage::current());
+    for (int i = 0; i < num_workers; i++)
+    {
+        SmapsUsage usage;
+        if (server.memory_usage(i, usage))
+            return -1;
+
+        char name[64];
+        snprintf(name, sizeof(name), "worker %d", i);
+        print_smaps(name, usage);
+        fprintf(stdout, "%-24s spawn latency = %.2f ms\n", "", server.spawn_latency(i));
+    }
+
+    fprintf(stdout, "%d frames on %d workers in %.2f ms, %.2f fps\n", frames, num_workers, elapsed, frames * 1000.0 / elapsed);
+
+    return 0;
+}
+
+/// Memory of several models in one registry against the same models in separate processes
+static int bench_registry(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: registry [imagepath] [bundlepath]\n");
+        return -1;
+    }
+
+    cv::Mat m = load_image(argv[0]);
+    if (m.empty())
+        return -1;
+
+    const char* bundlepath = argc > 1 ? argv[1] : nullptr;
+
+    // the same weights at two input sizes, plus a bundle if one is given
+    struct Entry {
+        const char* id;
+        int target_size;
+        const char* bundle;
+    };
+    std::vector<Entry> entries = {{"tiny-640", 640, nullptr}, {"tiny-416", 416, nullptr}};
+    if (bundlepath)
+        entries.push_back({"bundle", 0, bundlepath});
+
+    auto create = [](const Entry& e) {
+        return std::unique_ptr<YoloV7>(e.bundle ? new YoloV7(e.bundle) : new YoloV7(e.target_size));
+    };
+
+    SmapsUsage separate;
+    for (const Entry& e : entries)
+    {
+        auto run = [&](SmapsUsage& usage) {
+            std::unique_ptr<YoloV7> yolov7 = create(e);
+            std::vector<Object> objects;
+            if (yolov7->init() || yolov7->detect(m, objects))
+                return -1;
+            usage = SmapsUsage::current();
+            return 0;
+        };
+
+        SmapsUsage usage;
+        if (run_in_child(run, usage))
+            return -1;
+
+        print_smaps(e.id, usage);
+        separate.rss += usage.rss;
+        separate.private_clean += usage.private_clean;
+        separate.private_dirty += usage.private_dirty;
+    }
+
+    auto run_registry = [&](SmapsUsage& usage) {
+        ModelRegistry registry;
+        for (const Entry& e : entries)
+        {
+            if (registry.add(e.id, create(e)))
+                return -1;
+        }
+
+        std::vector<Object> objects;
+        for (const Entry& e : entries)
+        {
+            if (registry.detect(e.id, m, objects))
+                return -1;
+        }
+
+        fprintf(stdout, "%d detectors on %d networks\n", (int)entries.size(), registry.num_networks());
+        fflush(stdout);
+
+        usage = SmapsUsage::current();
+        return 0;
+    };
+
+    SmapsUsage registry_usage;
+    if (run_in_child(run_registry, registry_usage))
+        return -1;
+
+    fprintf(stdout, "%-24s rss = %7ld kB  private = %7ld kB\n", "separate processes", separate.rss,
+            separate.private_clean + separate.private_dirty);
+    fprintf(stdout, "%-24s rss = %7ld kB  private = %7ld kB\n", "registry", registry_usage.rss,
+            registry_usage.private_clean + registry_usage.private_dirty);
+
+    return 0;
+}
+
+/// Synthetic BGR image with smooth gradients and some noise, so that resizing does real work
+static cv::Mat synthetic_image(int w, int h)
+{
+    cv::Mat m(h, w, CV_8UC3);
+
+    unsigned int seed = 1;
+    for (int y = 0; y < h; y++)
+    {
+        unsigned char* p = m.data + y * w * 3;
+        for (int x = 0; x < w; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            p[0] = (unsigned char)(x * 255 / w);
+            p[1] = (unsigned char)(y * 255 / h);
+            p[2] = (unsigned char)(seed >> 24);
+            p += 3;
+        }
+    }
+
+    return m;
+}
+
+/// Letterbox preprocessing of 1080p and 4K frames into the 640 input,
+/// fused single pass against ncnn's resize, copy_make_border and substract_mean_normalize
+static int bench_preprocess(int argc, char** argv)
+{
+    const int loops = argc > 0 ? atoi(argv[0]) : 50;
+    const int target_size = argc > 1 ? atoi(argv[1]) : 640;
+
+    const int sizes[][2] = {{1920, 1080}, {3840, 2160}};
+
+    for (const auto& size : sizes)
+    {
+        cv::Mat m = synthetic_image(size[0], size[1]);
+        Letterbox lb = make_letterbox(m.cols, m.rows, target_size, 64);
+
+        ncnn::Mat fused, reference;
+        Stats fused_stats, reference_stats;
+
+        for (int i = 0; i < loops; i++)
+        {
+            double start = ncnn::get_current_time();
+            letterbox_bgr2rgb_ncnn(m.data, m.cols * 3, lb, reference);
+            double mid = ncnn::get_current_time();
+            letterbox_bgr2rgb(m.data, m.cols * 3, lb, fused);
+            double end = ncnn::get_current_time();
+
+            reference_stats.add(mid - start);
+            fused_stats.add(end - mid);
+        }
+
+        // both use the same bilinear coefficients, differences come from fixed point rounding in ncnn
+        float max_diff = 0;
+        for (int q = 0; q < fused.c; q++)
+        {
+            const float* a = fused.channel(q);
+            const float* b = reference.channel(q);
+            for (int j = 0; j < fused.w * fused.h; j++)
+                max_diff = std::max(max_diff, std::fabs(a[j] - b[j]));
+        }
+
+        fprintf(stdout, "%dx%d -> %dx%d\n", m.cols, m.rows, lb.in_w(), lb.in_h());
+        print_stats("three pass", reference_stats);
+        print_stats("fused", fused_stats);
+        fprintf(stdout, "%-24s speedup = %.2fx  max diff = %.4f (%.2f / 255)\n", "",
+                reference_stats.avg() / fused_stats.avg(), max_diff, max_diff * 255);
+    }
+
+    return 0;
+}
+
+/// Row kernels of the letterbox, the kernels selected for this CPU against the scalar fallback,
+/// on rows of a 1080p frame and for the whole 1080p letterbox
+static int bench_kernels(int argc, char** argv)
+{
+    const int loops = argc > 0 ? atoi(argv[0]) : 1000;
+
+    const PreprocessKernels& scalar = scalar_preprocess_kernels();
+    const PreprocessKernels& vector = preprocess_kernels();
+
+    fprintf(stdout, "selected kernels: %s\n", vector.name);
+
+    const int n = 1920;
+    cv::Mat m = synthetic_image(n, 1);
+    std::vector<float> row0(n * 3, 0.25f), row1(n * 3, 0.75f), out(n * 3);
+
+    const PreprocessKernels* kernels[] = {&scalar, &vector};
+    Stats bgr2rgb_stats[2], blend_stats[2], fill_stats[2], letterbox_stats[2];
+
+    for (int k = 0; k < 2; k++)
+    {
+        const PreprocessKernels& kernel = *kernels[k];
+
+        for (int i = 0; i < loops; i++)
+        {
+            double t0 = ncnn::get_current_time();
+            kernel.bgr2rgb(m.data, n, out.data(), out.data() + n, out.data() + n * 2, 1 / 255.f);
+            double t1 = ncnn::get_current_time();
+            kernel.blend(row0.data(), row1.data(), 0.5f / 255, 0.5f / 255, out.data(), n * 3);
+            double t2 = ncnn::get_current_time();
+            kernel.fill(out.data(), n * 3, 114 / 255.f);
+            double t3 = ncnn::get_current_time();
+
+            bgr2rgb_stats[k].add(t1 - t0);
+            blend_stats[k].add(t2 - t1);
+            fill_stats[k].add(t3 - t2);
+        }
+    }
+
+    cv::Mat frame = synthetic_image(1920, 1080);
+    Letterbox lb = make_letterbox(frame.cols, frame.rows, 640, 64);
+    ncnn::Mat in;
+    for (int k = 0; k < 2; k++)
+    {
+        for (int i = 0; i < loops / 20 + 1; i++)
+        {
+            double start = ncnn::get_current_time();
+            letterbox_bgr2rgb(frame.data, frame.cols * 3, lb, in, 114.f, 1 / 255.f, kernels[k]);
+            letterbox_stats[k].add(ncnn::get_current_time() - start);
+        }
+    }
+
+    const struct {
+        const char* name;
+        const Stats* stats;
+    } results[] = {
+        {"bgr2rgb 1920 px", bgr2rgb_stats},
+        {"blend 3x1920", blend_stats},
+        {"fill 3x1920", fill_stats},
+        {"letterbox 1080p", letterbox_stats},
+    };
+
+    char name[64];
+    for (const auto& result : results)
+    {
+        snprintf(name, sizeof(name), "%s (scalar)", result.name);
+        print_stats(name, result.stats[0]);
+        snprintf(name, sizeof(name), "%s (%s)", result.name, vector.name);
+        print_stats(name, result.stats[1]);
+        fprintf(stdout, "%-24s speedup = %.2fx\n", "", result.stats[0].avg() / result.stats[1].avg());
+    }
+
+    return 0;
+}
+
+/// NV12 camera frame to network input: converted to a full resolution image first as before,
+/// resized in YUV with resize_bilinear_yuv420sp and converted afterwards, and the fused single pass
+static int bench_yuv(int argc, char** argv)
+{
+    const int loops = argc > 0 ? atoi(argv[0]) : 50;
+    const int w = argc > 1 ? atoi(argv[1]) : 1280;
+    const int h = argc > 2 ? atoi(argv[2]) : 720;
+
+    if (w % 2 || h % 2)
+    {
+        fprintf(stderr, "yuv needs an even frame size\n");
+        return -1;
+    }
+
+    // gray frame with a synthetic luma gradient
+    std::vector<unsigned char> nv12(w * h * 3 / 2, 128);
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+            nv12[y * w + x] = (unsigned char)(16 + (x + y) % 220);
+    }
+
+    Letterbox lb = make_letterbox(w, h, 640, 64);
+
+    // resize_bilinear_yuv420sp needs an even size
+    const int rw = lb.w & ~1;
+    const int rh = lb.h & ~1;
+    Letterbox small_lb = make_letterbox(rw, rh, std::max(rw, rh), 64);
+
+    std::vector<unsigned char> full(w * h * 3);
+    std::vector<unsigned char> small_yuv(rw * rh * 3 / 2);
+    std::vector<unsigned char> small(rw * rh * 3);
+    ncnn::Mat in;
+
+    Stats full_stats, small_stats, fused_stats;
+    for (int i = 0; i < loops; i++)
+    {
+        // the channel order does not matter for the timing
+        double t0 = ncnn::get_current_time();
+        ncnn::yuv420sp2rgb_nv12(nv12.data(), w, h, full.data());
+        letterbox_bgr2rgb(full.data(), w * 3, lb, in);
+        double t1 = ncnn::get_current_time();
+        ncnn::resize_bilinear_yuv420sp(nv12.data(), w, h, small_yuv.data(), rw, rh);
+        ncnn::yuv420sp2rgb_nv12(small_yuv.data(), rw, rh, small.data());
+        letterbox_bgr2rgb(small.data(), rw * 3, small_lb, in);
+        double t2 = ncnn::get_current_time();
+        letterbox_yuv420sp2rgb(nv12.data(), lb, in);
+        double t3 = ncnn::get_current_time();
+
+        full_stats.add(t1 - t0);
+        small_stats.add(t2 - t1);
+        fused_stats.add(t3 - t2);
+    }
+
+    // bytes read and written per frame, every buffer is written once and read once
+    const double mb = 1024 * 1024;
+    const double frame = w * h * 3 / 2;
+    const double input = lb.in_w() * lb.in_h() * 3 * sizeof(float);
+    const double full_traffic = frame + 2.0 * w * h * 3 + input;
+    const double small_traffic = frame + 2.0 * rw * rh * 3 / 2 + 2.0 * rw * rh * 3 + input;
+    const double fused_traffic = frame + input;
+
+    fprintf(stdout, "%dx%d NV12 -> %dx%d\n", w, h, lb.in_w(), lb.in_h());
+    print_stats("via full size RGB", full_stats);
+    fprintf(stdout, "%-24s traffic = %6.2f MB  extra buffers = %7.1f kB\n", "", full_traffic / mb, w * h * 3 / 1024.0);
+    print_stats("resize in YUV", small_stats);
+    fprintf(stdout, "%-24s traffic = %6.2f MB  extra buffers = %7.1f kB\n", "", small_traffic / mb,
+            (rw * rh * 3 / 2 + rw * rh * 3) / 1024.0);
+    print_stats("fused", fused_stats);
+    fprintf(stdout, "%-24s traffic = %6.2f MB  extra buffers = %7.1f kB\n", "", fused_traffic / mb, 0.0);
+
+    return 0;
+}
+
+/// Loading a large JPEG for a detection: full size decode with cv::imread against decoding
+/// straight at a reduced size, each followed by the letterbox into the 640 input
+static int bench_jpeg(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: jpeg [imagepath] [loops=10]\n");
+        return -1;
+    }
+
+    const char* imagepath = argv[0];
+    const int loops = argc > 1 ? atoi(argv[1]) : 10;
+    const int target_size = 640;
+
+    Stats full_decode, full_letterbox, scaled_decode, scaled_letterbox;
+    ncnn::Mat in;
+    ScaledImage image;
+    int full_w = 0;
+    int full_h = 0;
+
+    for (int i = 0; i < loops; i++)
+    {
+        double t0 = ncnn::get_current_time();
+        cv::Mat m = load_image(imagepath);
+        if (m.empty())
+            return -1;
+        double t1 = ncnn::get_current_time();
+        letterbox_bgr2rgb(m.data, m.cols * 3, make_letterbox(m.cols, m.rows, target_size, 64), in);
+        double t2 = ncnn::get_current_time();
+
+        if (load_image_scaled(imagepath, target_size, image))
+            return -1;
+        double t3 = ncnn::get_current_time();
+        letterbox_bgr2rgb(image.bgr.data, image.bgr.cols * 3, make_letterbox(image.bgr.cols, image.bgr.rows, target_size, 64), in);
+        double t4 = ncnn::get_current_time();
+
+        full_w = m.cols;
+        full_h = m.rows;
+        full_decode.add(t1 - t0);
+        full_letterbox.add(t2 - t1);
+        scaled_decode.add(t3 - t2);
+        scaled_letterbox.add(t4 - t3);
+    }
+
+    fprintf(stdout, "%dx%d decoded at %dx%d (scale %.3f)\n", full_w, full_h, image.bgr.cols, image.bgr.rows, image.scale());
+    print_stats("full decode", full_decode);
+    print_stats("full letterbox", full_letterbox);
+    print_stats("scaled decode", scaled_decode);
+    print_stats("scaled letterbox", scaled_letterbox);
+    fprintf(stdout, "%-24s speedup = %.2fx\n", "",
+            (full_decode.avg() + full_letterbox.avg()) / (scaled_decode.avg() + scaled_letterbox.avg()));
+
+    return 0;
+}
+
+/// Detection latency over frames of mixed aspect ratios, padded to the next stride multiple
+/// against letterboxed into a few input buckets with their own buffers and pools
+static int bench_buckets(int argc, char** argv)
+{
+    const int frames = argc > 0 ? atoi(argv[0]) : 60;
+
+    // landscape, square and portrait frames as they come from different cameras
+    const int sizes[][2] = {{1920, 1080}, {1280, 960}, {1000, 1000}, {1280, 1024}, {1080, 1920},
+                            {1600, 900}, {800, 600}, {720, 1280}, {2048, 1536}, {640, 480}};
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    std::vector<cv::Mat> images;
+    for (const auto& size : sizes)
+        images.push_back(synthetic_image(size[0], size[1]));
+
+    const std::vector<std::pair<int, int>> buckets = {{640, 384}, {640, 480}, {640, 640}, {384, 640}, {480, 640}};
+
+    for (int bucketed = 0; bucketed < 2; bucketed++)
+    {
+        YoloV7 yolov7;
+        if (yolov7.init())
+            return -1;
+        if (bucketed && yolov7.set_input_buckets(buckets))
+            return -1;
+
+        // one pass over all shapes so that both variants start warm
+        std::vector<Object> objects;
+        for (const cv::Mat& image : images)
+            yolov7.detect(image, objects);
+
+        Stats stats;
+        for (int i = 0; i < frames; i++)
+        {
+            double start = ncnn::get_current_time();
+            if (yolov7.detect(images[i % num_sizes], objects))
+                return -1;
+            stats.add(ncnn::get_current_time() - start);
+        }
+
+        const char* name = bucketed ? "buckets" : "stride padding";
+        print_stats(name, stats);
+        fprintf(stdout, "%-24s stddev = %.2f ms  rss = %ld kB\n", "", stats.stddev(), MemoryUsage::current().rss);
+    }
+
+    return 0;
+}
+
+/// Tiled detection of a 4K frame with 1, 2 and 4 threads against a single downscaled detection
+static int bench_tiles(int argc, char** argv)
+{
+    const char* imagepath = argc > 0 && strcmp(argv[0], "-") != 0 ? argv[0] : nullptr;
+    const int frames = argc > 1 ? atoi(argv[1]) : 5;
+    const int tile_size = argc > 2 ? atoi(argv[2]) : 640;
+    const int overlap = argc > 3 ? atoi(argv[3]) : 128;
+
+    cv::Mat m = imagepath ? load_image(imagepath) : synthetic_image(3840, 2160);
+    if (m.empty())
+        return -1;
+
+    YoloV7 yolov7;
+    if (yolov7.init() || yolov7.warmup(1))
+        return -1;
+
+    std::vector<Object> objects;
+
+    Stats single_stats;
+    for (int i = 0; i < frames; i++)
+    {
+        double start = ncnn::get_current_time();
+        if (yolov7.detect(m, objects))
+            return -1;
+        single_stats.add(ncnn::get_current_time() - start);
+    }
+
+    const size_t num_tiles = make_tiles(m.cols, m.rows, tile_size, overlap).size();
+    fprintf(stdout, "%dx%d, %zu tiles of %d with overlap %d\n", m.cols, m.rows, num_tiles, tile_size, overlap);
+    print_stats("downscaled", single_stats);
+    fprintf(stdout, "%-24s %.2f fps  %zu objects\n", "", 1000 / single_stats.avg(), objects.size());
+
+    const int thread_counts[] = {1, 2, 4};
+    for (int num_threads : thread_counts)
+    {
+        TileOptions options;
+        options.tile_size = tile_size;
+        options.overlap = overlap;
+        options.num_threads = num_threads;
+
+        Stats stats;
+        for (int i = 0; i < frames; i++)
+        {
+            double start = ncnn::get_current_time();
+            if (yolov7.detect_tiled(m, objects, options))
+                return -1;
+            stats.add(ncnn::get_current_time() - start);
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "tiled, %d thread%s", num_threads, num_threads > 1 ? "s" : "");
+        print_stats(name, stats);
+        fprintf(stdout, "%-24s %.2f fps  %.1f tiles/s  %zu objects\n", "", 1000 / stats.avg(),
+                (num_tiles + 1) * 1000 / stats.avg(), objects.size());
+    }
+
+    return 0;
+}
+
+/// Detections with the input normalization folded into the first convolution against the regular model,
+/// matched in order, and the detection latency of both
+static int bench_fold(int argc, char** argv)
+{
+    const char* default_images[] = {"../resources/pics/bird.png", "../resources/pics/dog.png", "../resources/pics/squirrel.png"};
+    const int num_images = argc > 0 ? argc : 3;
+    const char* const* images = argc > 0 ? argv : default_images;
+
+    YoloV7 regular;
+    YoloV7 folded;
+    folded.set_fold_input_normalization(true);
+    if (regular.init() || folded.init() || regular.warmup(1) || folded.warmup(1))
+        return -1;
+
+    int failed = 0;
+    for (int i = 0; i < num_images; i++)
+    {
+        cv::Mat m = load_image(images[i]);
+        if (m.empty())
+            return -1;
+
+        std::vector<Object> expected, objects;
+        Stats regular_stats, folded_stats;
+        for (int j = 0; j < 5; j++)
+        {
+            double t0 = ncnn::get_current_time();
+            if (regular.detect(m, expected))
+                return -1;
+            double t1 = ncnn::get_current_time();
+            if (folded.detect(m, objects))
+                return -1;
+            double t2 = ncnn::get_current_time();
+
+            regular_stats.add(t1 - t0);
+            folded_stats.add(t2 - t1);
+        }
+
+        float max_prob_diff = 0;
+        float max_box_diff = 0;
+        bool same_labels = expected.size() == objects.size();
+        for (size_t j = 0; same_labels && j < objects.size(); j++)
+        {
+            const Object& a = expected[j];
+            const Object& b = objects[j];
+            same_labels = a.label == b.label;
+            max_prob_diff = std::max(max_prob_diff, std::fabs(a.prob - b.prob));
+            max_box_diff = std::max({max_box_diff, std::fabs(a.rect.x - b.rect.x), std::fabs(a.rect.y - b.rect.y),
+                                     std::fabs(a.rect.width - b.rect.width), std::fabs(a.rect.height - b.rect.height)});
+        }
+
+        // the folded weights are float32 where the model file may store float16, tiny deviations are expected
+        const bool ok = same_labels && max_prob_diff < 0.01f && max_box_diff < 1.f;
+        failed += !ok;
+
+        fprintf(stdout, "%s: %zu / %zu objects  max prob diff = %.5f  max box diff = %.3f px  %s\n", images[i],
+                objects.size(), expected.size(), max_prob_diff, max_box_diff, ok ? "ok" : "MISMATCH");
+        print_stats("regular", regular_stats);
+        print_stats("folded", folded_stats);
+    }
+
+    return failed ? -1 : 0;
+}
+
+/// Detection latency for 1 to N inference threads with speedup and parallel efficiency against one thread
+static int bench_threads(int argc, char** argv)
+{
+    const char* imagepath = argc > 0 && strcmp(argv[0], "-") != 0 ? argv[0] : nullptr;
+    const int frames = argc > 1 ? atoi(argv[1]) : 20;
+    const int powersave = argc > 2 ? atoi(argv[2]) : 0;
+
+    cv::Mat m = imagepath ? load_image(imagepath) : synthetic_image(1280, 720);
+    if (m.empty())
+        return -1;
+
+    YoloV7 yolov7;
+    if (yolov7.init())
+        return -1;
+
+    const int max_threads = ncnn::get_physical_cpu_count();
+    fprintf(stdout, "%d cpus, %d physical, powersave %d\n", ncnn::get_cpu_count(), max_threads, powersave);
+
+    std::vector<Object> objects;
+    double single = 0;
+    for (int num_threads = 1; num_threads <= max_threads; num_threads++)
+    {
+        ThreadOptions options;
+        options.num_threads = num_threads;
+        options.powersave = powersave;
+        if (yolov7.set_threading(options) || yolov7.warmup(2))
+            return -1;
+
+        Stats stats;
+        for (int i = 0; i < frames; i++)
+        {
+            double start = ncnn::get_current_time();
+            if (yolov7.detect(m, objects))
+                return -1;
+            stats.add(ncnn::get_current_time() - start);
+        }
+
+        if (num_threads == 1)
+            single = stats.avg();
+
+        char name[32];
+        snprintf(name, sizeof(name), "%d thread%s", num_threads, num_threads > 1 ? "s" : "");
+        print_stats(name, stats);
+        fprintf(stdout, "%-24s speedup = %.2fx  efficiency = %.0f %%\n", "", single / stats.avg(),
+                100 * single / stats.avg() / num_threads);
+    }
+
+    return 0;
+}
+
+/// Frame stream through detect one frame after the other against the three-stage pipeline,
+/// throughput and end-to-end latency from submitting a frame to its result
+static int bench_pipeline(int argc, char** argv)
+{
+    const char* imagepath = argc > 0 && strcmp(argv[0], "-") != 0 ? argv[0] : nullptr;
+    const int frames = argc > 1 ? atoi(argv[1]) : 100;
+    const int depth = argc > 2 ? atoi(argv[2]) : 4;
+
+    cv::Mat m = imagepath ? load_image(imagepath) : synthetic_image(1920, 1080);
+    if (m.empty())
+        return -1;
+
+    YoloV7 yolov7;
+    if (yolov7.init() || yolov7.warmup(2))
+        return -1;
+
+    // sequential, latency equals the time per frame
+    Stats sequential_stats;
+    std::vector<Object> objects;
+    double start = ncnn::get_current_time();
+    for (int i = 0; i < frames; i++)
+    {
+        double t = ncnn::get_current_time();
+        if (yolov7.detect(m, objects))
+            return -1;
+        sequential_stats.add(ncnn::get_current_time() - t);
+    }
+    double sequential_time = ncnn::get_current_time() - start;
+
+    // pipelined, the stages are pinned to the first three cores if there are enough
+    Stats pipelined_stats;
+    std::vector<int> cpus;
+    if (ncnn::get_cpu_count() >= 3)
+        cpus = {0, 1, 2};
+
+    FramePipeline pipeline(yolov7, depth);
+    auto on_result = [&pipelined_stats](uint64_t, const cv::Mat&, const std::vector<Object>&, double latency) {
+        pipelined_stats.add(latency);
+    };
+    if (pipeline.start(on_result, cpus))
+        return -1;
+
+    start = ncnn::get_current_time();
+    for (int i = 0; i < frames; i++)
+    {
+        if (pipeline.submit(m))
+            return -1;
+    }
+    pipeline.stop();
+    double pipelined_time = ncnn::get_current_time() - start;
+
+    fprintf(stdout, "%dx%d, %d frames, pipeline depth %d\n", m.cols, m.rows, frames, depth);
+    print_stats("sequential latency", sequential_stats);
+    fprintf(stdout, "%-24s %.2f fps\n", "", frames * 1000 / sequential_time);
+    print_stats("pipelined latency", pipelined_stats);
+    fprintf(stdout, "%-24s %.2f fps\n", "", frames * 1000 / pipelined_time);
+
+    return 0;
+}
+
+/// Allocations per frame of the worker pools from the first frame on, and latency with and without them
+static int bench_pools(int argc, char** argv)
+{
+    const char* imagepath = argc > 0 && strcmp(argv[0], "-") != 0 ? argv[0] : nullptr;
+    const int frames = argc > 1 ? atoi(argv[1]) : 20;
+    PoolOptions options;
+    options.size_compare_ratio = argc > 2 ? atof(argv[2]) : options.size_compare_ratio;
+    options.size_drop_threshold = argc > 3 ? atoi(argv[3]) : options.size_drop_threshold;
+
+    cv::Mat m = imagepath ? load_image(imagepath) : synthetic_image(1920, 1080);
+    if (m.empty())
+        return -1;
+
+    fprintf(stdout, "%dx%d, %d frames, size compare ratio %.2f, drop threshold %zu\n",
+            m.cols, m.rows, frames, options.size_compare_ratio, options.size_drop_threshold);
+
+    for (int pooled = 0; pooled < 2; pooled++)
+    {
+        options.enabled = pooled;
+
+        YoloV7 yolov7;
+        if (yolov7.init() || yolov7.set_pool_options(options))
+            return -1;
+
+        // no warmup, the first frames are the ones that fill the pools
+        Stats stats;
+        std::vector<Object> objects;
+        AllocatorStats last = yolov7.allocator_stats();
+        for (int i = 0; i < frames; i++)
+        {
+            double start = ncnn::get_current_time();
+            if (yolov7.detect(m, objects))
+                return -1;
+            stats.add(ncnn::get_current_time() - start);
+
+            AllocatorStats now = yolov7.allocator_stats();
+            if (pooled && (i < 5 || i == frames - 1))
+                fprintf(stdout, "frame %-4d %6zu requests  %6zu mallocs\n", i + 1, now.requests - last.requests, now.mallocs - last.mallocs);
+            last = now;
+        }
+
+        print_stats(pooled ? "worker pools" : "default allocation", stats);
+        if (pooled)
+            fprintf(stdout, "%-24s %zu allocator pairs, %zu mallocs in %zu requests\n", "", last.workers, last.mallocs, last.requests);
+        fprintf(stdout, "%-24s rss = %ld kB\n", "", MemoryUsage::current().rss);
+    }
+
+    return 0;
+}
+
+/// Capture thread at a fixed frame rate, stalled by `detect` against queueing frames with `detect_async`
+static int bench_async(int argc, char** argv)
+{
+    const char* imagepath = argc > 0 && strcmp(argv[0], "-") != 0 ? argv[0] : nullptr;
+    const int frames = argc > 1 ? atoi(argv[1]) : 60;
+    const double fps = argc > 2 ? atof(argv[2]) : 30;
+    AsyncOptions options;
+    options.num_workers = argc > 3 ? atoi(argv[3]) : 2;
+    options.queue_size = argc > 4 ? atoi(argv[4]) : 2;
+
+    cv::Mat m = imagepath ? load_image(imagepath) : synthetic_image(1920, 1080);
+    if (m.empty())
+        return -1;
+
+    YoloV7 yolov7;
+    if (yolov7.init() || yolov7.warmup(2))
+        return -1;
+
+    const double interval = 1000 / fps;
+    fprintf(stdout, "%dx%d, %d frames at %.1f fps, %d workers, queue size %d\n",
+            m.cols, m.rows, frames, fps, options.num_workers, options.queue_size);
+
+    // a frame is missed if the capture thread is still busy when the next one arrives
+    Stats sync_stall;
+    int sync_missed = 0;
+    std::vector<Object> objects;
+    double next = ncnn::get_current_time();
+    for (int i = 0; i < frames; i++)
+    {
+        double start = ncnn::get_current_time();
+        if (yolov7.detect(m, objects))
+            return -1;
+        double end = ncnn::get_current_time();
+        sync_stall.add(end - start);
+
+        next += interval;
+        for (; next < end; next += interval)
+            sync_missed++;
+        std::this_thread::sleep_for(std::chrono::microseconds((long)((next - end) * 1000)));
+    }
+    print_stats("detect stall", sync_stall);
+    fprintf(stdout, "%-24s %d frames missed at capture\n", "", sync_missed);
+
+    const struct {
+        const char* name;
+        OverloadPolicy overload;
+    } policies[] = {{"block", OverloadPolicy::Block}, {"reject", OverloadPolicy::Reject}, {"drop oldest", OverloadPolicy::DropOldest}};
+
+    for (const auto& policy : policies)
+    {
+        options.overload = policy.overload;
+        if (yolov7.set_async_options(options))
+            return -1;
+
+        Stats stall;
+        int missed = 0;
+        std::vector<std::future<std::vector<Object>>> results;
+        next = ncnn::get_current_time();
+        for (int i = 0; i < frames; i++)
+        {
+            double start = ncnn::get_current_time();
+            results.push_back(yolov7.detect_async(m));
+            double end = ncnn::get_current_time();
+            stall.add(end - start);
+
+            next += interval;
+            for (; next < end; next += interval)
+                missed++;
+            std::this_thread::sleep_for(std::chrono::microseconds((long)((next - end) * 1000)));
+        }
+
+        int failed = 0;
+        for (std::future<std::vector<Object>>& result : results)
+        {
+            try
+            {
+                result.get();
+            }
+            catch (const std::runtime_error&)
+            {
+                failed++;
+            }
+        }
+
+        AsyncStats stats = yolov7.async_stats();
+        char name[64];
+        snprintf(name, sizeof(name), "detect_async %s", policy.name);
+        print_stats(name, stall);
+        fprintf(stdout, "%-24s %d frames missed at capture, %d without result\n", "", missed, failed);
+        fprintf(stdout, "%-24s completed = %zu  rejected = %zu  dropped = %zu  max depth = %d\n",
+                "", stats.completed, stats.rejected, stats.dropped, stats.max_queue_depth);
+        fprintf(stdout, "%-24s queue wait avg = %.2f ms  max = %.2f ms\n", "", stats.avg_wait, stats.max_wait);
+    }
+
+    return 0;
+}
+
+// anchors of the default model, three per stride
+static const float default_anchors[3][6] = {{12, 16, 19, 36, 40, 28}, {36, 75, 76, 55, 72, 146}, {142, 110, 192, 243, 459, 401}};
+static const int default_strides[3] = {8, 16, 32};
+
+/// Synthetic head output with `num_outputs` channels, low objectness logits and a few confident cells
+static ncnn::Mat synthetic_head(int grid, int num_outputs, int num_classes)
+{
+    ncnn::Mat feat(grid, grid, num_outputs);
+
+    unsigned int seed = 12345;
+    for (int c = 0; c < num_outputs; c++)
+    {
+        const bool objectness = c % (num_classes + 5) == 4;
+        float* ptr = feat.channel(c);
+        for (int i = 0; i < grid * grid; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            float r = (seed >> 8) / float(1 << 24);
+            ptr[i] = objectness ? (r < 0.01f ? 4.f : -8.f + 4 * r) : -6.f + 8 * r;
+        }
+    }
+
+    return feat;
+}
+
+/// Head decoder on synthetic 255-channel maps per stride, cell by cell from strided planes against row-wise kernels
+static int bench_decoder(int argc, char** argv)
+{
+    const int loops = argc > 0 ? atoi(argv[0]) : 100;
+    const int target_size = argc > 1 ? atoi(argv[1]) : 640;
+
+    const int num_classes = 80;
+    const float (*anchors)[6] = default_anchors;
+    const int* strides = default_strides;
+
+    const DecodeKernels& scalar = scalar_decode_kernels();
+    const DecodeKernels& vector = decode_kernels();
+    fprintf(stdout, "selected kernels: %s\n", vector.name);
+
+    for (int s = 0; s < 3; s++)
+    {
+        const int grid = target_size / strides[s];
+        ncnn::Mat feat = synthetic_head(grid, 3 * (num_classes + 5), num_classes);
+
+        Stats stats[3];
+        size_t found[3] = {};
+        for (int i = 0; i < loops; i++)
+        {
+            std::vector<Object> objects[3];
+
+            double t0 = ncnn::get_current_time();
+            decode_proposals_strided(feat, anchors[s], 3, strides[s], num_classes, 0.25f, objects[0]);
+            double t1 = ncnn::get_current_time();
+            decode_proposals_rows(feat, anchors[s], 3, strides[s], num_classes, 0.25f, objects[1], &scalar);
+            double t2 = ncnn::get_current_time();
+            decode_proposals_rows(feat, anchors[s], 3, strides[s], num_classes, 0.25f, objects[2], &vector);
+            double t3 = ncnn::get_current_time();
+
+            stats[0].add(t1 - t0);
+            stats[1].add(t2 - t1);
+            stats[2].add(t3 - t2);
+            for (int k = 0; k < 3; k++)
+                found[k] = objects[k].size();
+        }
+
+        fprintf(stdout, "stride %d, %dx%dx%d\n", strides[s], grid, grid, feat.c);
+
+        const char* names[] = {"strided per cell", "rows scalar", "rows vector"};
+        char name[64];
+        for (int k = 0; k < 3; k++)
+        {
+            snprintf(name, sizeof(name), "  %s", names[k]);
+            print_stats(name, stats[k]);
+            fprintf(stdout, "%-24s %zu proposals  speedup %.2fx\n", "", found[k], stats[0].avg() / stats[k].avg());
+        }
+    }
+
+    return 0;
+}
+
+/// Objectness prefilter of the two-phase decoder on the head outputs of real frames against the single pass decoder
+static int bench_twophase(int argc, char** argv)
+{
+    const char* default_images[] = {"../resources/pics/bird.png", "../resources/pics/dog.png", "../resources/pics/squirrel.png"};
+    const int num_images = argc > 0 ? argc : 3;
+    const char* const* images = argc > 0 ? argv : default_images;
+
+    const int loops = 20;
+    const int num_classes = 80;
+    const float prob_threshold = 0.25f;
+
+    YoloV7 yolov7;
+    if (yolov7.init() || yolov7.warmup(1))
+        return -1;
+
+    for (int i = 0; i < num_images; i++)
+    {
+        cv::Mat m = load_image(images[i]);
+        if (m.empty())
+            return -1;
+
+        DetectionState state;
+        if (yolov7.preprocess(m, state) || yolov7.infer(state))
+            return -1;
+
+        Stats single_stats, two_phase_stats;
+        DecodeStats decode_stats;
+        size_t single_found = 0, two_phase_found = 0;
+        for (int j = 0; j < loops; j++)
+        {
+            std::vector<Object> single, two_phase;
+            DecodeStats stats;
+
+            double t0 = ncnn::get_current_time();
+            for (size_t k = 0; k < state.outputs.size(); k++)
+                decode_proposals_rows(state.outputs[k], default_anchors[k], 3, default_strides[k], num_classes, prob_threshold, single);
+            double t1 = ncnn::get_current_time();
+            for (size_t k = 0; k < state.outputs.size(); k++)
+                decode_proposals(state.outputs[k], default_anchors[k], 3, default_strides[k], num_classes, prob_threshold, two_phase, nullptr, &stats);
+            double t2 = ncnn::get_current_time();
+
+            single_stats.add(t1 - t0);
+            two_phase_stats.add(t2 - t1);
+            single_found = single.size();
+            two_phase_found = two_phase.size();
+            decode_stats = stats;
+        }
+
+        fprintf(stdout, "%s, %dx%d input\n", images[i], state.in.w, state.in.h);
+        print_stats("  single pass", single_stats);
+        print_stats("  two phase", two_phase_stats);
+        fprintf(stdout, "%-24s %zu cells, %zu candidates, %.1f %% eliminated by objectness\n", "",
+                decode_stats.cells, decode_stats.candidates, 100.0 * (decode_stats.cells - decode_stats.candidates) / decode_stats.cells);
+        fprintf(stdout, "%-24s %zu / %zu proposals, %.3f ms saved per frame\n", "",
+                two_phase_found, single_found, single_stats.avg() - two_phase_stats.avg());
+    }
+
+    return 0;
+}
+
+/// Detection latency and multiply-accumulates of the detection heads with sparse head evaluation against dense convolutions
+static int bench_sparse(int argc, char** argv)
+{
+    const char* default_images[] = {"../resources/pics/bird.png", "../resources/pics/dog.png", "../resources/pics/squirrel.png"};
+    const int num_images = argc > 0 ? argc : 3;
+    const char* const* images = argc > 0 ? argv : default_images;
+
+    const int loops = 5;
+
+    YoloV7 dense;
+    YoloV7 sparse;
+    sparse.set_sparse_heads(true);
+    if (dense.init() || sparse.init() || dense.warmup(1) || sparse.warmup(1))
+        return -1;
+
+    int failed = 0;
+    for (int i = 0; i < num_images; i++)
+    {
+        cv::Mat m = load_image(images[i]);
+        if (m.empty())
+            return -1;
+
+        std::vector<Object> expected, objects;
+        Stats dense_stats, sparse_stats;
+        SparseHeadStats before = sparse.sparse_head_stats();
+        for (int j = 0; j < loops; j++)
+        {
+            double t0 = ncnn::get_current_time();
+            if (dense.detect(m, expected))
+                return -1;
+            double t1 = ncnn::get_current_time();
+            if (sparse.detect(m, objects))
+                return -1;
+            double t2 = ncnn::get_current_time();
+
+            dense_stats.add(t1 - t0);
+            sparse_stats.add(t2 - t1);
+        }
+        SparseHeadStats after = sparse.sparse_head_stats();
+
+        // the computed channels come from the same dot products, only their summation order differs
+        bool same = expected.size() == objects.size();
+        for (size_t j = 0; same && j < objects.size(); j++)
+        {
+            same = expected[j].label == objects[j].label && std::fabs(expected[j].prob - objects[j].prob) < 0.01f &&
+                   std::fabs(expected[j].rect.x - objects[j].rect.x) < 1.f && std::fabs(expected[j].rect.y - objects[j].rect.y) < 1.f;
+        }
+        failed += !same;
+
+        const double cells = (double)(after.cells - before.cells) / loops;
+        const double candidates = (double)(after.candidates - before.candidates) / loops;
+        const double dense_macs = (double)(after.dense_macs - before.dense_macs) / loops;
+        const double sparse_macs = (double)(after.sparse_macs - before.sparse_macs) / loops;
+
+        fprintf(stdout, "%s: %zu / %zu objects  %s\n", images[i], objects.size(), expected.size(), same ? "ok" : "MISMATCH");
+        print_stats("  dense", dense_stats);
+        print_stats("  sparse heads", sparse_stats);
+        fprintf(stdout, "%-24s %.0f cells, %.0f candidates (%.2f %%)\n", "", cells, candidates, cells ? 100.0 * candidates / cells : 0.0);
+        fprintf(stdout, "%-24s head MACs %.1f M -> %.1f M (%.1f %% saved), %.3f ms saved per frame\n", "",
+                dense_macs / 1e6, sparse_macs / 1e6, dense_macs ? 100.0 * (dense_macs - sparse_macs) / dense_macs : 0.0,
+                dense_stats.avg() - sparse_stats.avg());
+    }
+
+    return failed ? -1 : 0;
+}
+
+/// Head multiply-accumulates and detection latency of models specialized to 1, 3 and 10 classes against all 80
+static int bench_subset(int argc, char** argv)
+{
+    const char* imagepath = argc > 0 ? argv[0] : "../resources/pics/dog.png";
+    const char* param = "../resources/yolov7_tiny.torchscript.ncnn.param";
+    const char* bin = "../resources/yolov7_tiny.torchscript.ncnn.bin";
+
+    // person, car, dog first, then other common street and household classes
+    const int class_ids[] = {0, 2, 16, 1, 3, 5, 7, 9, 15, 56};
+    const int subset_sizes[] = {1, 3, 10};
+    const int loops = 10;
+
+    cv::Mat m = load_image(imagepath);
+    if (m.empty())
+        return -1;
+
+    YoloV7 full;
+    if (full.init() || full.warmup(1))
+        return -1;
+
+    DetectionState state;
+    if (full.preprocess(m, state) || full.infer(state))
+        return -1;
+
+    Stats full_stats;
+    std::vector<Object> expected;
+    for (int j = 0; j < loops; j++)
+    {
+        double start = ncnn::get_current_time();
+        if (full.detect(m, expected))
+            return -1;
+        full_stats.add(ncnn::get_current_time() - start);
+    }
+
+    fprintf(stdout, "%s, %dx%d input\n", imagepath, state.in.w, state.in.h);
+    print_stats("80 classes", full_stats);
+
+    for (int k : subset_sizes)
+    {
+        ClassSubset subset;
+        subset.class_ids.assign(class_ids, class_ids + k);
+
+        std::string sliced_param;
+        std::vector<unsigned char> sliced_model;
+        std::vector<SlicedHead> heads;
+        if (slice_class_subset_files(subset, param, bin, sliced_param, sliced_model, &heads))
+            return -1;
+
+        // heads in the order of the outputs, one MAC per weight and grid cell
+        double dense_macs = 0, sliced_macs = 0;
+        for (size_t i = 0; i < heads.size() && i < state.outputs.size(); i++)
+        {
+            const double cells = (double)state.outputs[i].w * state.outputs[i].h;
+            dense_macs += cells * heads[i].num_input * heads[i].num_output;
+            sliced_macs += cells * heads[i].num_input * heads[i].sliced_num_output;
+        }
+
+        YoloV7 specialized;
+        if (specialized.set_class_subset(subset.class_ids) || specialized.init() || specialized.warmup(1))
+            return -1;
+
+        Stats stats;
+        std::vector<Object> objects;
+        for (int j = 0; j < loops; j++)
+        {
+            double start = ncnn::get_current_time();
+            if (specialized.detect(m, objects))
+                return -1;
+            stats.add(ncnn::get_current_time() - start);
+        }
+
+        // a cell whose best class was dropped may now report its best kept class, so this is not an exact match
+        size_t expected_in_subset = 0;
+        for (const Object& obj : expected)
+            expected_in_subset += std::find(subset.class_ids.begin(), subset.class_ids.end(), obj.label) != subset.class_ids.end();
+
+        char name[32];
+        snprintf(name, sizeof(name), "%d classes", k);
+        print_stats(name, stats);
+        fprintf(stdout, "%-24s head MACs %.1f M -> %.1f M (%.1f %% saved), %.3f ms saved per frame\n", "",
+                dense_macs / 1e6, sliced_macs / 1e6, 100.0 * (dense_macs - sliced_macs) / dense_macs, full_stats.avg() - stats.avg());
+        fprintf(stdout, "%-24s %zu objects, %zu of the 80 class model are in the subset\n", "", objects.size(), expected_in_subset);
+    }
+
+    return 0;
+}
+
+/// Pre-NMS sorting of 100, 1k and 10k synthetic proposals, the recursive OpenMP sections quicksort
+/// against a plain sort of all proposals and the bounded top-K selection
+static int bench_topk(int argc, char** argv)
+{
+    const int max_candidates = argc > 0 ? atoi(argv[0]) : 1000;
+    const int sizes[] = {100, 1000, 10000};
+    const int loops = 50;
+
+    if (max_candidates <= 0)
+        return -1;
+
+    int failed = 0;
+    for (int n : sizes)
+    {
+        std::vector<Object> proposals(n);
+        unsigned int seed = 1;
+        for (Object& obj : proposals)
+        {
+            seed = seed * 1103515245 + 12345;
+            obj.prob = 0.25f + 0.75f * (seed >> 8) / 16777216.f;
+            obj.label = (seed >> 4) % 80;
+            obj.rect = cv::Rect_<float>((float)(seed % 600), (float)((seed >> 10) % 600), 40.f, 40.f);
+        }
+
+        Stats qsort_stats, sort_stats, topk_stats;
+        std::vector<Object> sorted, all, top;
+        for (int j = 0; j < loops; j++)
+        {
+            sorted = proposals;
+            all = proposals;
+            top = proposals;
+
+            double t0 = ncnn::get_current_time();
+            qsort_descent_inplace(sorted);
+            double t1 = ncnn::get_current_time();
+            sort_top_proposals(all, 0);
+            double t2 = ncnn::get_current_time();
+            sort_top_proposals(top, max_candidates);
+            double t3 = ncnn::get_current_time();
+
+            qsort_stats.add(t1 - t0);
+            sort_stats.add(t2 - t1);
+            topk_stats.add(t3 - t2);
+        }
+
+        // ties may be ordered differently, the probabilities must not
+        bool same = top.size() == std::min(sorted.size(), (size_t)max_candidates);
+        for (size_t j = 0; same && j < top.size(); j++)
+            same = top[j].prob == sorted[j].prob && all[j].prob == sorted[j].prob;
+        failed += !same;
+
+        fprintf(stdout, "%d proposals, top %d  %s\n", n, max_candidates, same ? "ok" : "MISMATCH");
+        print_stats("  omp sections qsort", qsort_stats);
+        print_stats("  std::sort", sort_stats);
+        char name[32];
+        snprintf(name, sizeof(name), "  top %d", max_candidates);
+        print_stats(name, topk_stats);
+    }
+
+    return failed ? -1 : 0;
+}
+
+struct Benchmark {
+    const char* name;
+    int (*run)(int argc, char** argv);
+};
+
+static const Benchmark benchmarks[] = {
+    {"latency", bench_latency},
+    {"load", bench_load},
+    {"startup", bench_startup},
+    {"prefork", bench_prefork},
+    {"phases", bench_phases},
+    {"swap", bench_swap},
+    {"registry", bench_registry},
+    {"preprocess", bench_preprocess},
+    {"kernels", bench_kernels},
+    {"yuv", bench_yuv},
+    {"jpeg", bench_jpeg},
+    {"buckets", bench_buckets},
+    {"tiles", bench_tiles},
+    {"fold", bench_fold},
+    {"threads", bench_threads},
+    {"pipeline", bench_pipeline},
+    {"pools", bench_pools},
+    {"async", bench_async},
+    {"decoder", bench_decoder},
+    {"twophase", bench_twophase},
+    {"sparse", bench_sparse},
+    {"subset", bench_subset},
+    {"topk", bench_topk},
+};
+
+int main(int argc, char** argv)
+{
+    const int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+    if (argc >= 2)
+    {
+        for (int i = 0; i < num_benchmarks; i++)
+        {
+            if (strcmp(argv[1], benchmarks[i].name) == 0)
+                return benchmarks[i].run(argc - 2, argv + 2);
+        }
+    }
+
+    fprintf(stderr, "Usage: %s [benchmark] [args...]\n", argv[0]);
+    fprintf(stderr, "Benchmarks:");
+    for (int i = 0; i < num_benchmarks; i++)
+        fprintf(stderr, " %s", benchmarks[i].name);
+    fprintf(stderr, "\n");
+
+    return -1;
+}
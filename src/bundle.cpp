@@ -0,0 +1,424 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "bundle.h"
+
+#include <layer.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Yolo;
+
+static size_t align_size(size_t size)
+{
+    return (size + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+}
+
+/// Lookup table of the reflected CRC-32 polynomial
+struct Crc32Table {
+    uint32_t values[256];
+
+    Crc32Table()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            this->values[i] = c;
+        }
+    }
+};
+
+uint32_t Bundle::crc32(const unsigned char* data, size_t size, uint32_t crc)
+{
+    // built once on first use, the initialization of a local static is thread safe
+    static const Crc32Table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+int Bundle::open(const char* path)
+{
+    close();
+
+    if (this->file.open(path))
+        return -1;
+
+    this->mem = this->file.data();
+    this->mem_size = this->file.size();
+
+    if (validate(path, true))
+    {
+        close();
+        return -1;
+    }
+
+    return 0;
+}
+
+int Bundle::open(const unsigned char* data, size_t size, bool verify_checksums)
+{
+    close();
+
+    if ((uintptr_t)data % BUNDLE_ALIGNMENT)
+    {
+        fprintf(stderr, "bundle at %p is not aligned to %d bytes\n", (const void*)data, (int)BUNDLE_ALIGNMENT);
+        return -1;
+    }
+
+    this->mem = data;
+    this->mem_size = size;
+
+    if (validate("embedded bundle", verify_checksums))
+    {
+        close();
+        return -1;
+    }
+
+    return 0;
+}
+
+int Bundle::validate(const char* path, bool verify_checksums)
+{
+    const unsigned char* data = this->mem;
+    const size_t size = this->mem_size;
+
+    if (size < sizeof(BundleHeader))
+    {
+        fprintf(stderr, "%s is not a bundle, file too small\n", path);
+        return -1;
+    }
+
+    const BundleHeader* h = (const BundleHeader*)data;
+
+    if (h->magic != BUNDLE_MAGIC)
+    {
+        fprintf(stderr, "%s is not a bundle, bad magic\n", path);
+        return -1;
+    }
+
+    if (h->version != BUNDLE_VERSION)
+    {
+        fprintf(stderr, "%s has bundle version %u, expected %u\n", path, h->version, BUNDLE_VERSION);
+        return -1;
+    }
+
+    BundleHeader copy = *h;
+    copy.checksum = 0;
+    if (crc32((const unsigned char*)&copy, sizeof(copy)) != h->checksum || h->num_sections > (uint32_t)BUNDLE_MAX_SECTIONS)
+    {
+        fprintf(stderr, "%s has a corrupt bundle header\n", path);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < h->num_sections; i++)
+    {
+        const BundleSection& s = h->sections[i];
+
+        if (s.offset % BUNDLE_ALIGNMENT || s.offset > size || s.size > size - s.offset)
+        {
+            fprintf(stderr, "%s section %u is out of bounds\n", path, s.type);
+            return -1;
+        }
+
+        if (verify_checksums && crc32(data + s.offset, s.size) != s.checksum)
+        {
+            fprintf(stderr, "%s section %u checksum mismatch\n", path, s.type);
+            return -1;
+        }
+    }
+
+    this->header = h;
+
+    size_t config_size = 0;
+    this->cfg = (const BundleConfig*)section(BUNDLE_SECTION_CONFIG, &config_size);
+    if (!section(BUNDLE_SECTION_PARAM) || !section(BUNDLE_SECTION_MODEL) || !this->cfg || config_size != sizeof(BundleConfig))
+    {
+        fprintf(stderr, "%s is missing required sections\n", path);
+        this->header = nullptr;
+        this->cfg = nullptr;
+        return -1;
+    }
+
+    if (this->cfg->num_outputs < 1 || this->cfg->num_outputs > BUNDLE_MAX_OUTPUTS)
+    {
+        fprintf(stderr, "%s has an invalid output count %d\n", path, this->cfg->num_outputs);
+        this->header = nullptr;
+        this->cfg = nullptr;
+        return -1;
+    }
+
+    return 0;
+}
+
+void Bundle::close()
+{
+    this->header = nullptr;
+    this->cfg = nullptr;
+    this->mem = nullptr;
+    this->mem_size = 0;
+    this->file.close();
+}
+
+bool Bundle::is_open() const
+{
+    return this->header != nullptr;
+}
+
+const unsigned char* Bundle::section(BundleSectionType type, size_t* size) const
+{
+    if (!this->header)
+        return nullptr;
+
+    for (uint32_t i = 0; i < this->header->num_sections; i++)
+    {
+        const BundleSection& s = this->header->sections[i];
+        if (s.type == type)
+        {
+            if (size)
+                *size = s.size;
+            return this->mem + s.offset;
+        }
+    }
+
+    return nullptr;
+}
+
+const BundleConfig& Bundle::config() const
+{
+    return *this->cfg;
+}
+
+std::vector<std::string> Bundle::labels() const
+{
+    std::vector<std::string> labels;
+
+    size_t size = 0;
+    const char* p = (const char*)section(BUNDLE_SECTION_LABELS, &size);
+    const char* end = p + size;
+
+    while (p && p < end)
+    {
+        size_t len = strnlen(p, end - p);
+        labels.emplace_back(p, len);
+        p += len + 1;
+    }
+
+    return labels;
+}
+
+int Bundle::write(const char* path, const std::vector<unsigned char>& param, const std::vector<unsigned char>& model, const BundleConfig& config, const std::vector<std::string>& labels)
+{
+    std::vector<unsigned char> label_data;
+    for (const auto& label : labels)
+    {
+        label_data.insert(label_data.end(), label.begin(), label.end());
+        label_data.push_back('\0');
+    }
+
+    const unsigned char* contents[] = {param.data(), model.data(), (const unsigned char*)&config, label_data.data()};
+    const size_t sizes[] = {param.size(), model.size(), sizeof(config), label_data.size()};
+    const BundleSectionType types[] = {BUNDLE_SECTION_PARAM, BUNDLE_SECTION_MODEL, BUNDLE_SECTION_CONFIG, BUNDLE_SECTION_LABELS};
+    const int num_sections = sizeof(types) / sizeof(types[0]);
+
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BUNDLE_MAGIC;
+    header.version = BUNDLE_VERSION;
+    header.num_sections = num_sections;
+
+    size_t offset = align_size(sizeof(header));
+    for (int i = 0; i < num_sections; i++)
+    {
+        header.sections[i].type = types[i];
+        header.sections[i].checksum = crc32(contents[i], sizes[i]);
+        header.sections[i].offset = offset;
+        header.sections[i].size = sizes[i];
+        offset = align_size(offset + sizes[i]);
+    }
+    header.checksum = crc32((const unsigned char*)&header, sizeof(header));
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    std::vector<unsigned char> page(align_size(sizeof(header)), 0);
+    memcpy(page.data(), &header, sizeof(header));
+    bool ok = fwrite(page.data(), 1, page.size(), fp) == page.size();
+
+    for (int i = 0; i < num_sections && ok; i++)
+    {
+        const size_t padded = align_size(sizes[i]);
+        ok = fwrite(contents[i], 1, sizes[i], fp) == sizes[i];
+
+        std::vector<unsigned char> padding(padded - sizes[i], 0);
+        ok = ok && fwrite(padding.data(), 1, padding.size(), fp) == padding.size();
+    }
+
+    if (fclose(fp) || !ok)
+    {
+        fprintf(stderr, "write %s failed\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void append_int(std::vector<unsigned char>& out, int32_t v)
+{
+    const unsigned char* p = (const unsigned char*)&v;
+    out.insert(out.end(), p, p + sizeof(v));
+}
+
+static void append_value(std::vector<unsigned char>& out, const char* vstr)
+{
+    // same rule as ncnn's text param parser, a dot or an exponent makes a float
+    bool is_float = strchr(vstr, '.') || strchr(vstr, 'e') || strchr(vstr, 'E');
+
+    if (is_float)
+    {
+        float f = strtof(vstr, nullptr);
+        int32_t v;
+        memcpy(&v, &f, sizeof(v));
+        append_int(out, v);
+    }
+    else
+    {
+        append_int(out, atoi(vstr));
+    }
+}
+
+int Bundle::convert_param(const char* path, std::vector<unsigned char>& out, std::map<std::string, int>& blob_indexes)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    int magic = 0;
+    int layer_count = 0;
+    int blob_count = 0;
+    if (fscanf(fp, "%d", &magic) != 1 || magic != 7767517 || fscanf(fp, "%d %d", &layer_count, &blob_count) != 2)
+    {
+        fprintf(stderr, "%s is not an ncnn param file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    append_int(out, magic);
+    append_int(out, layer_count);
+    append_int(out, blob_count);
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        char layer_type[256];
+        char layer_name[256];
+        int bottom_count = 0;
+        int top_count = 0;
+        if (fscanf(fp, "%255s %255s %d %d", layer_type, layer_name, &bottom_count, &top_count) != 4)
+        {
+            fprintf(stderr, "%s layer %d is truncated\n", path, i);
+            fclose(fp);
+            return -1;
+        }
+
+        int typeindex = ncnn::layer_to_index(layer_type);
+        if (typeindex < 0)
+        {
+            fprintf(stderr, "layer type %s is not built into ncnn\n", layer_type);
+            fclose(fp);
+            return -1;
+        }
+
+        append_int(out, typeindex);
+        append_int(out, bottom_count);
+        append_int(out, top_count);
+
+        for (int j = 0; j < bottom_count + top_count; j++)
+        {
+            char blob_name[256];
+            if (fscanf(fp, "%255s", blob_name) != 1)
+            {
+                fprintf(stderr, "%s layer %s is truncated\n", path, layer_name);
+                fclose(fp);
+                return -1;
+            }
+
+            // ncnn numbers blobs in the order they first appear as a top
+            if (j >= bottom_count)
+            {
+                int index = (int)blob_indexes.size();
+                blob_indexes[blob_name] = index;
+            }
+
+            auto it = blob_indexes.find(blob_name);
+            if (it == blob_indexes.end())
+            {
+                fprintf(stderr, "%s layer %s uses undefined blob %s\n", path, layer_name, blob_name);
+                fclose(fp);
+                return -1;
+            }
+
+            append_int(out, it->second);
+        }
+
+        // key=value pairs until the end of the line
+        int c;
+        while ((c = fgetc(fp)) != EOF && c != '\n')
+        {
+            if (c == ' ' || c == '\t' || c == '\r')
+                continue;
+
+            ungetc(c, fp);
+
+            char pair[4096];
+            if (fscanf(fp, "%4095s", pair) != 1)
+                break;
+
+            char* eq = strchr(pair, '=');
+            if (!eq)
+            {
+                fprintf(stderr, "%s layer %s has malformed param %s\n", path, layer_name, pair);
+                fclose(fp);
+                return -1;
+            }
+            *eq = '\0';
+
+            int id = atoi(pair);
+            append_int(out, id);
+
+            if (id <= -23300)
+            {
+                // array, count followed by the values
+                char* count_end = strchr(eq + 1, ',');
+                append_int(out, atoi(eq + 1));
+
+                for (char* v = count_end; v; v = strchr(v + 1, ','))
+                    append_value(out, v + 1);
+            }
+            else
+            {
+                append_value(out, eq + 1);
+            }
+        }
+
+        append_int(out, -233);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
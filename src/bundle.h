@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_BUNDLE_H
+#define NCNN_YOLO_BUNDLE_H
+
+#include "mmap_datareader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Yolo {
+
+    // Bundle file layout, all values little endian
+    //
+    //   BundleHeader             page 0, section table and header checksum
+    //   section data             every section starts on a BUNDLE_ALIGNMENT boundary
+    //
+    // The header and every section carry a CRC-32, so the whole file is validated
+    // in one pass over the mapping before anything is handed to ncnn.
+
+    const uint32_t BUNDLE_MAGIC = 0x42375659; // "YV7B"
+    const uint32_t BUNDLE_VERSION = 1;
+    const size_t BUNDLE_ALIGNMENT = 4096;
+    const int BUNDLE_MAX_SECTIONS = 8;
+    const int BUNDLE_MAX_OUTPUTS = 4;
+    const int BUNDLE_MAX_NAME = 32;
+
+    enum BundleSectionType : uint32_t {
+        BUNDLE_SECTION_PARAM = 1,   // ncnn binary param, as read by Net::load_param(const unsigned char*)
+        BUNDLE_SECTION_MODEL = 2,   // ncnn weights, as read by Net::load_model(const unsigned char*)
+        BUNDLE_SECTION_CONFIG = 3,  // BundleConfig
+        BUNDLE_SECTION_LABELS = 4,  // class labels, each terminated by '\0'
+    };
+
+    struct BundleSection {
+        uint32_t type;
+        uint32_t checksum;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct BundleHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t num_sections;
+        uint32_t checksum;          // CRC-32 of the header with this field set to 0
+        BundleSection sections[BUNDLE_MAX_SECTIONS];
+    };
+
+    /// Detector configuration, the binary param has no blob names so inputs and outputs are addressed by index
+    struct BundleConfig {
+        int32_t target_size;
+        int32_t num_classes;
+        float prob_threshold;
+        float nms_threshold;
+        int32_t input_index;
+        int32_t num_outputs;
+        int32_t output_indexes[BUNDLE_MAX_OUTPUTS];
+        int32_t strides[BUNDLE_MAX_OUTPUTS];
+        float anchors[BUNDLE_MAX_OUTPUTS * 6];
+        char input_name[BUNDLE_MAX_NAME];
+        char output_names[BUNDLE_MAX_OUTPUTS][BUNDLE_MAX_NAME];
+    };
+
+    /// @brief Versioned single-file model bundle with param, weights, configuration and class labels
+    class Bundle {
+    public:
+        /// @brief Maps a bundle file and validates header, section table and checksums
+        /// @param path Path to the bundle file
+        /// @return `0` on success, `-1` if the file is missing, truncated or corrupt
+        int open(const char* path);
+
+        /// @brief Validates a bundle that is already in memory, e.g. embedded into the executable
+        /// @param data Start of the bundle, must be aligned to `BUNDLE_ALIGNMENT`
+        /// @param size Size of the bundle in bytes
+        /// @param verify_checksums Also verify the section checksums, the header is always verified
+        /// @return `0` on success, `-1` if the bundle is truncated or corrupt
+        int open(const unsigned char* data, size_t size, bool verify_checksums = true);
+
+        /// @brief Unmaps the bundle, all section pointers become invalid
+        void close();
+
+        /// @brief Checks whether a valid bundle is mapped
+        bool is_open() const;
+
+        /// @brief Start of a section inside the mapping
+        /// @param type Section type
+        /// @param size Receives the section size in bytes
+        /// @return Pointer to the section data, `nullptr` if the bundle has no such section
+        const unsigned char* section(BundleSectionType type, size_t* size = nullptr) const;
+
+        /// @brief Detector configuration of the bundle
+        const BundleConfig& config() const;
+
+        /// @brief Class labels of the bundle
+        std::vector<std::string> labels() const;
+
+        /// @brief Writes a bundle file
+        /// @param path Path of the bundle file
+        /// @param param ncnn binary param
+        /// @param model ncnn weights
+        /// @param config Detector configuration
+        /// @param labels Class labels
+        /// @return `0` on success, `-1` on write errors
+        static int write(const char* path,
+                         const std::vector<unsigned char> &param,
+                         const std::vector<unsigned char> &model,
+                         const BundleConfig &config,
+                         const std::vector<std::string> &labels);
+
+        /// @brief Converts a text param file into the binary param read by `Net::load_param(const unsigned char*)`
+        /// @param path Path to the text param file
+        /// @param out Receives the binary param
+        /// @param blob_indexes Receives the blob index of every blob name, the binary format carries no names
+        /// @return `0` on success, `-1` if the file is missing or malformed
+        static int convert_param(const char* path,
+                                 std::vector<unsigned char> &out,
+                                 std::map<std::string, int> &blob_indexes);
+
+        /// @brief CRC-32 (IEEE 802.3) of a memory range
+        static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+    private:
+        int validate(const char* name, bool verify_checksums);
+
+        MmapDataReader file;
+        const unsigned char* mem{};
+        size_t mem_size{};
+        const BundleHeader* header{};
+        const BundleConfig* cfg{};
+    };
+}
+
+#endif //NCNN_YOLO_BUNDLE_H
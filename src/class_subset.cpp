@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "class_subset.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+using namespace Yolo;
+
+// storage tags at the start of a weight blob, see ncnn's ModelBinFromDataReader
+static const unsigned int TAG_FLOAT16 = 0x01306B47;
+static const unsigned int TAG_INT8 = 0x000D4B38;
+static const unsigned int TAG_FLOAT32_RAW = 0x0002C056;
+
+// layers of the yolov7 exports that load no weights
+static const char* const weightless_layers[] = {
+    "Input", "Split", "Concat", "Pooling", "Interp", "Sigmoid", "Swish", "ReLU", "Clip", "HardSigmoid", "HardSwish",
+    "Mish", "BinaryOp", "UnaryOp", "Eltwise", "Permute", "Reshape", "Flatten", "Crop", "Slice", "Padding", "Noop",
+    "Dropout", "Softmax", "ShuffleChannel"
+};
+
+static size_t align4(size_t size)
+{
+    return (size + 3) / 4 * 4;
+}
+
+static int read_file(const char* path, std::vector<unsigned char>& out)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    out.resize(size > 0 ? size : 0);
+    bool ok = size > 0 && fread(out.data(), 1, out.size(), fp) == out.size();
+    fclose(fp);
+
+    if (!ok)
+    {
+        fprintf(stderr, "fread %s failed\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// One layer line of a text param
+struct ParamLine {
+    std::string type;
+    std::string name;
+    std::vector<std::string> bottoms;
+    std::vector<std::string> tops;
+    std::vector<std::string> params;        // `key=value` as written
+
+    int get(int key, int default_value) const
+    {
+        for (const std::string& p : this->params)
+        {
+            char* end;
+            long k = strtol(p.c_str(), &end, 10);
+            if (*end == '=' && k == key)
+                return atoi(end + 1);
+        }
+
+        return default_value;
+    }
+
+    void set(int key, int value)
+    {
+        const std::string prefix = std::to_string(key) + "=";
+        for (std::string& p : this->params)
+        {
+            if (p.compare(0, prefix.size(), prefix) == 0)
+            {
+                p = prefix + std::to_string(value);
+                return;
+            }
+        }
+
+        this->params.push_back(prefix + std::to_string(value));
+    }
+
+    std::string str() const
+    {
+        std::string line = this->type + " " + this->name + " " + std::to_string(this->bottoms.size()) + " " + std::to_string(this->tops.size());
+        for (const std::string& b : this->bottoms)
+            line += " " + b;
+        for (const std::string& t : this->tops)
+            line += " " + t;
+        for (const std::string& p : this->params)
+            line += " " + p;
+
+        return line;
+    }
+};
+
+static int parse_line(const std::string& text, ParamLine& line)
+{
+    std::istringstream in(text);
+    size_t num_bottoms = 0, num_tops = 0;
+    if (!(in >> line.type >> line.name >> num_bottoms >> num_tops))
+        return -1;
+
+    line.bottoms.resize(num_bottoms);
+    line.tops.resize(num_tops);
+    for (std::string& b : line.bottoms)
+        in >> b;
+    for (std::string& t : line.tops)
+        in >> t;
+
+    std::string p;
+    while (in >> p)
+        line.params.push_back(p);
+
+    return in.bad() ? -1 : 0;
+}
+
+/// Layout of a weight blob behind its storage tag, float16 and 8 bit blobs are padded to 4 bytes
+static int weight_blob_layout(const unsigned char* p, size_t avail, size_t w, size_t& header, size_t& elemsize, size_t& payload)
+{
+    if (avail < sizeof(unsigned int))
+        return -1;
+
+    unsigned int tag;
+    memcpy(&tag, p, sizeof(tag));
+    header = sizeof(tag);
+
+    if (tag == TAG_FLOAT16)
+    {
+        elemsize = 2;
+        payload = align4(w * 2);
+    }
+    else if (tag == TAG_INT8)
+    {
+        elemsize = 1;
+        payload = align4(w);
+    }
+    else if (tag == TAG_FLOAT32_RAW || tag == 0)
+    {
+        elemsize = 4;
+        payload = w * 4;
+    }
+    else
+    {
+        // any other tag is a table of 256 float values followed by 8 bit indexes
+        header += 256 * sizeof(float);
+        elemsize = 1;
+        payload = align4(w);
+    }
+
+    return header + payload <= avail ? 0 : -1;
+}
+
+/// Appends the rows of `channels` from a blob of `row_size` byte rows and pads it to 4 bytes
+static void copy_rows(const unsigned char* rows, size_t row_size, const std::vector<int>& channels, std::vector<unsigned char>& out)
+{
+    const size_t start = out.size();
+    for (int c : channels)
+        out.insert(out.end(), rows + c * row_size, rows + (c + 1) * row_size);
+
+    out.resize(start + align4(out.size() - start), 0);
+}
+
+int Yolo::parse_class_ids(const char* list, std::vector<int>& class_ids)
+{
+    class_ids.clear();
+
+    const char* p = list;
+    while (*p)
+    {
+        char* end;
+        long id = strtol(p, &end, 10);
+        if (end == p || (*end != ',' && *end != '\0'))
+        {
+            fprintf(stderr, "%s is not a comma separated list of class ids\n", list);
+            return -1;
+        }
+
+        class_ids.push_back((int)id);
+        p = *end ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+int Yolo::check_class_ids(const std::vector<int>& class_ids, int num_classes)
+{
+    if (class_ids.empty())
+    {
+        fprintf(stderr, "a class subset needs at least one class\n");
+        return -1;
+    }
+
+    std::set<int> seen;
+    for (int id : class_ids)
+    {
+        if (id < 0 || id >= num_classes || !seen.insert(id).second)
+        {
+            fprintf(stderr, "class id %d is repeated or outside 0 ~ %d\n", id, num_classes - 1);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int Yolo::slice_class_subset(const ClassSubset& subset, const std::string& param, const unsigned char* model, size_t model_size,
+                             std::string& sliced_param, std::vector<unsigned char>& sliced_model, std::vector<SlicedHead>* heads)
+{
+    if (check_class_ids(subset.class_ids, subset.num_classes))
+        return -1;
+
+    const int num_per_anchor = 5 + subset.num_classes;
+    const int sliced_per_anchor = 5 + (int)subset.class_ids.size();
+
+    // box, objectness and the kept classes of every anchor
+    std::vector<int> channels;
+    for (int q = 0; q < subset.num_anchors; q++)
+    {
+        for (int k = 0; k < 5; k++)
+            channels.push_back(q * num_per_anchor + k);
+        for (int id : subset.class_ids)
+            channels.push_back(q * num_per_anchor + 5 + id);
+    }
+
+    std::istringstream in(param);
+    std::string text;
+    sliced_param.clear();
+    sliced_model.clear();
+    sliced_model.reserve(model_size);
+    if (heads)
+        heads->clear();
+
+    // magic number and layer / blob counts stay as they are
+    for (int i = 0; i < 2 && std::getline(in, text); i++)
+        sliced_param += text + "\n";
+
+    size_t offset = 0;
+    int num_heads = 0;
+    while (std::getline(in, text))
+    {
+        if (text.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        ParamLine line;
+        if (parse_line(text, line))
+        {
+            fprintf(stderr, "cannot parse param line %s\n", text.c_str());
+            return -1;
+        }
+
+        if (line.type != "Convolution")
+        {
+            const char* const* end = weightless_layers + sizeof(weightless_layers) / sizeof(weightless_layers[0]);
+            if (std::find_if(weightless_layers, end, [&line](const char* t) { return line.type == t; }) == end)
+            {
+                fprintf(stderr, "layer %s of type %s may hold weights, only convolutions are supported\n", line.name.c_str(), line.type.c_str());
+                return -1;
+            }
+
+            sliced_param += text + "\n";
+            continue;
+        }
+
+        const int num_output = line.get(0, 0);
+        const int bias_term = line.get(5, 0);
+        const int weight_data_size = line.get(6, 0);
+        if (line.get(8, 0) || line.get(19, 0) || num_output <= 0 || weight_data_size % num_output)
+        {
+            fprintf(stderr, "convolution %s is quantized or has dynamic weights\n", line.name.c_str());
+            return -1;
+        }
+
+        size_t header, elemsize, payload;
+        if (weight_blob_layout(model + offset, model_size - offset, weight_data_size, header, elemsize, payload) ||
+            (bias_term && offset + header + payload + num_output * sizeof(float) > model_size))
+        {
+            fprintf(stderr, "weights end inside convolution %s\n", line.name.c_str());
+            return -1;
+        }
+
+        const unsigned char* weights = model + offset + header;
+        const unsigned char* bias = weights + payload;
+        const size_t blob_size = header + payload + (bias_term ? num_output * sizeof(float) : 0);
+
+        const bool is_head = line.tops.size() == 1 && num_output == subset.num_anchors * num_per_anchor &&
+                             std::find(subset.output_names.begin(), subset.output_names.end(), line.tops[0]) != subset.output_names.end();
+        if (!is_head)
+        {
+            sliced_param += text + "\n";
+            sliced_model.insert(sliced_model.end(), model + offset, model + offset + blob_size);
+            offset += blob_size;
+            continue;
+        }
+
+        const int num_input = weight_data_size / num_output;
+        const int sliced_num_output = subset.num_anchors * sliced_per_anchor;
+
+        line.set(0, sliced_num_output);
+        line.set(6, sliced_num_output * num_input);
+        sliced_param += line.str() + "\n";
+
+        // storage tag and quantization table, then the kept rows and bias values
+        sliced_model.insert(sliced_model.end(), model + offset, weights);
+        copy_rows(weights, num_input * elemsize, channels, sliced_model);
+        if (bias_term)
+            copy_rows(bias, sizeof(float), channels, sliced_model);
+
+        if (heads)
+            heads->push_back({line.name, line.tops[0], num_input, num_output, sliced_num_output});
+
+        offset += blob_size;
+        num_heads++;
+    }
+
+    if (offset != model_size)
+    {
+        fprintf(stderr, "%zu bytes of weights are not used by the param\n", model_size - offset);
+        return -1;
+    }
+
+    if (num_heads != (int)subset.output_names.size())
+    {
+        fprintf(stderr, "found %d of %d detection heads with %d outputs\n", num_heads, (int)subset.output_names.size(),
+                subset.num_anchors * num_per_anchor);
+        return -1;
+    }
+
+    return 0;
+}
+
+int Yolo::slice_class_subset_files(const ClassSubset& subset, const char* path_to_param, const char* path_to_bin,
+                                   std::string& sliced_param, std::vector<unsigned char>& sliced_model, std::vector<SlicedHead>* heads)
+{
+    std::vector<unsigned char> param, model;
+    if (read_file(path_to_param, param) || read_file(path_to_bin, model))
+        return -1;
+
+    return slice_class_subset(subset, std::string(param.begin(), param.end()), model.data(), model.size(), sliced_param, sliced_model, heads);
+}
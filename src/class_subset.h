@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_CLASS_SUBSET_H
+#define NCNN_YOLO_CLASS_SUBSET_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Yolo {
+
+    /// Classes a model is specialized to and the heads that are sliced for them
+    struct ClassSubset {
+        std::vector<int> class_ids;         // classes of the original model that are kept, in output order
+        int num_classes = 80;               // classes of the original model
+        int num_anchors = 3;                // anchors per head
+        std::vector<std::string> output_names = {"out0", "out1", "out2"};
+    };
+
+    /// Shape of one sliced detection head, a 1x1 convolution computes `num_input * num_output` MACs per cell
+    struct SlicedHead {
+        std::string name;
+        std::string top;
+        int num_input{};
+        int num_output{};
+        int sliced_num_output{};
+    };
+
+    /// @brief Parses a comma separated list of class ids such as `0,2,16`
+    /// @return `0` on success, `-1` if an id is not a number
+    int parse_class_ids(const char* list,
+                        std::vector<int> &class_ids);
+
+    /// @brief Checks that the ids are distinct and below `num_classes`
+    /// @return `0` if the subset is valid, `-1` otherwise
+    int check_class_ids(const std::vector<int> &class_ids,
+                        int num_classes);
+
+    /// @brief Slices the detection heads of a model down to a subset of its classes
+    ///
+    /// Every convolution whose only output is a network output and that has `num_anchors * (5 + num_classes)`
+    /// outputs keeps the box and objectness channels and the class channels in `class_ids` of each anchor,
+    /// `num_output` and `weight_data_size` of its param line are rewritten. The weights of the other layers
+    /// are copied unchanged, the sliced weights keep their storage type.
+    /// @param subset Classes to keep
+    /// @param param Text param of the model
+    /// @param model Weights of the model
+    /// @param model_size Size of the weights in bytes
+    /// @param sliced_param Receives the rewritten text param
+    /// @param sliced_model Receives the rewritten weights
+    /// @param heads Receives the shape of every sliced head if not null
+    /// @return `0` on success, `-1` if the param has layers with weights other than convolutions, a head was not found
+    /// or the weights do not match the param
+    int slice_class_subset(const ClassSubset &subset,
+                           const std::string &param,
+                           const unsigned char* model,
+                           size_t model_size,
+                           std::string &sliced_param,
+                           std::vector<unsigned char> &sliced_model,
+                           std::vector<SlicedHead>* heads = nullptr);
+
+    /// @brief Runs `slice_class_subset` on a param and a bin file
+    int slice_class_subset_files(const ClassSubset &subset,
+                                 const char* path_to_param,
+                                 const char* path_to_bin,
+                                 std::string &sliced_param,
+                                 std::vector<unsigned char> &sliced_model,
+                                 std::vector<SlicedHead>* heads = nullptr);
+}
+
+#endif //NCNN_YOLO_CLASS_SUBSET_H
@@ -0,0 +1,402 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "decoder.h"
+
+#include <cpu.h>
+#if __riscv_vector
+#include <riscv_vector.h>
+#endif
+#if __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <cfloat>
+#include <cmath>
+
+using namespace Yolo;
+
+static inline float sigmoid(float x)
+{
+    return static_cast<float>(1.f / (1.f + exp(-x)));
+}
+
+/// Argmax of `m` cells, with `m` a constant the running maxima stay in registers across the planes
+template<int m>
+static inline void argmax_block(const float* planes, size_t cstep, int num_planes, float* max_value, int* max_index)
+{
+    float value[m];
+    int index[m];
+    for (int j = 0; j < m; j++)
+    {
+        value[j] = planes[j];
+        index[j] = 0;
+    }
+
+    for (int k = 1; k < num_planes; k++)
+    {
+        const float* plane = planes + k * cstep;
+        for (int j = 0; j < m; j++)
+        {
+            const bool greater = plane[j] > value[j];
+            index[j] = greater ? k : index[j];
+            value[j] = greater ? plane[j] : value[j];
+        }
+    }
+
+    for (int j = 0; j < m; j++)
+    {
+        max_value[j] = value[j];
+        max_index[j] = index[j];
+    }
+}
+
+static void argmax_scalar(const float* planes, size_t cstep, int num_planes, int n, float* max_value, int* max_index)
+{
+    int j = 0;
+    for (; j + 7 < n; j += 8)
+    {
+        argmax_block<8>(planes + j, cstep, num_planes, max_value + j, max_index + j);
+    }
+    for (; j < n; j++)
+    {
+        argmax_block<1>(planes + j, cstep, num_planes, max_value + j, max_index + j);
+    }
+}
+
+/// Compacts the cells `begin` to `end` of a row
+static int compact_range(const float* row, int begin, int end, float threshold, int* indexes)
+{
+    int count = 0;
+    for (int j = begin; j < end; j++)
+    {
+        // written unconditionally, the count only advances for passing cells
+        indexes[count] = j;
+        count += row[j] >= threshold;
+    }
+
+    return count;
+}
+
+static int compact_scalar(const float* row, int n, float threshold, int* indexes)
+{
+    return compact_range(row, 0, n, threshold, indexes);
+}
+
+#if __riscv_vector
+// RVV 0.7.1 on the C906 with the XuanTie toolchain, one strip of cells is kept in registers across all planes
+static void argmax_rvv(const float* planes, size_t cstep, int num_planes, int n, float* max_value, int* max_index)
+{
+    while (n > 0)
+    {
+        size_t vl = vsetvl_e32m4(n);
+
+        vfloat32m4_t _max = vle32_v_f32m4(planes, vl);
+        vint32m4_t _index = vmv_v_x_i32m4(0, vl);
+
+        for (int k = 1; k < num_planes; k++)
+        {
+            vfloat32m4_t _p = vle32_v_f32m4(planes + k * cstep, vl);
+            vbool8_t _greater = vmfgt_vv_f32m4_b8(_p, _max, vl);
+            _max = vfmax_vv_f32m4(_max, _p, vl);
+            _index = vmerge_vxm_i32m4(_greater, _index, k, vl);
+        }
+
+        vse32_v_f32m4(max_value, _max, vl);
+        vse32_v_i32m4(max_index, _index, vl);
+
+        planes += vl;
+        max_value += vl;
+        max_index += vl;
+        n -= vl;
+    }
+}
+
+static int compact_rvv(const float* row, int n, float threshold, int* indexes)
+{
+    int count = 0;
+    int offset = 0;
+    while (n > 0)
+    {
+        size_t vl = vsetvl_e32m4(n);
+
+        vbool8_t _pass = vmfge_vf_f32m4_b8(vle32_v_f32m4(row, vl), threshold, vl);
+        size_t num_pass = vpopc_m_b8(_pass, vl);
+        if (num_pass > 0)
+        {
+            vuint32m4_t _index = vadd_vx_u32m4(vid_v_u32m4(vl), offset, vl);
+            vuint32m4_t _packed = vcompress_vm_u32m4(_pass, _index, _index, vl);
+            vse32_v_u32m4((uint32_t*)indexes + count, _packed, num_pass);
+            count += num_pass;
+        }
+
+        row += vl;
+        offset += vl;
+        n -= vl;
+    }
+
+    return count;
+}
+
+static const DecodeKernels rvv_kernels = {"rvv", argmax_rvv, compact_rvv};
+#endif // __riscv_vector
+
+#if __ARM_NEON
+// AArch32 NEON on the Pi Zero 2, 8 cells per step in two registers with a scalar tail
+static void argmax_neon(const float* planes, size_t cstep, int num_planes, int n, float* max_value, int* max_index)
+{
+    int j = 0;
+    for (; j + 7 < n; j += 8)
+    {
+        float32x4_t _max0 = vld1q_f32(planes + j);
+        float32x4_t _max1 = vld1q_f32(planes + j + 4);
+        uint32x4_t _index0 = vdupq_n_u32(0);
+        uint32x4_t _index1 = vdupq_n_u32(0);
+
+        for (int k = 1; k < num_planes; k++)
+        {
+            const float* plane = planes + k * cstep + j;
+            float32x4_t _p0 = vld1q_f32(plane);
+            float32x4_t _p1 = vld1q_f32(plane + 4);
+            uint32x4_t _k = vdupq_n_u32(k);
+
+            _index0 = vbslq_u32(vcgtq_f32(_p0, _max0), _k, _index0);
+            _index1 = vbslq_u32(vcgtq_f32(_p1, _max1), _k, _index1);
+            _max0 = vmaxq_f32(_max0, _p0);
+            _max1 = vmaxq_f32(_max1, _p1);
+        }
+
+        vst1q_f32(max_value + j, _max0);
+        vst1q_f32(max_value + j + 4, _max1);
+        vst1q_s32(max_index + j, vreinterpretq_s32_u32(_index0));
+        vst1q_s32(max_index + j + 4, vreinterpretq_s32_u32(_index1));
+    }
+
+    argmax_scalar(planes + j, cstep, num_planes, n - j, max_value + j, max_index + j);
+}
+
+static int compact_neon(const float* row, int n, float threshold, int* indexes)
+{
+    float32x4_t _threshold = vdupq_n_f32(threshold);
+
+    // most cells fail, so only groups with a passing lane are looked at one by one
+    int count = 0;
+    int j = 0;
+    for (; j + 7 < n; j += 8)
+    {
+        uint32x4_t _pass = vorrq_u32(vcgeq_f32(vld1q_f32(row + j), _threshold), vcgeq_f32(vld1q_f32(row + j + 4), _threshold));
+        uint32x2_t _any = vorr_u32(vget_low_u32(_pass), vget_high_u32(_pass));
+        if (vget_lane_u32(vpmax_u32(_any, _any), 0) == 0)
+            continue;
+
+        count += compact_range(row, j, j + 8, threshold, indexes + count);
+    }
+
+    return count + compact_range(row, j, n, threshold, indexes + count);
+}
+
+static const DecodeKernels neon_kernels = {"neon", argmax_neon, compact_neon};
+#endif // __ARM_NEON
+
+static const DecodeKernels scalar_kernels = {"scalar", argmax_scalar, compact_scalar};
+
+static const DecodeKernels* select_kernels()
+{
+#if __riscv_vector
+    if (ncnn::cpu_support_riscv_v())
+        return &rvv_kernels;
+#endif
+#if __ARM_NEON
+    if (ncnn::cpu_support_arm_neon())
+        return &neon_kernels;
+#endif
+    return &scalar_kernels;
+}
+
+const DecodeKernels& Yolo::decode_kernels()
+{
+    static const DecodeKernels* kernels = select_kernels();
+    return *kernels;
+}
+
+const DecodeKernels& Yolo::scalar_decode_kernels()
+{
+    return scalar_kernels;
+}
+
+/// Box of anchor `q` at cell (`i`, `j`), the channels of the anchor start at `feat.channel(c)`
+static Object decode_box(const ncnn::Mat &feat, int c, int i, int j, const float* anchors, int q, int stride)
+{
+    float dx = sigmoid(feat.channel(c + 0).row(i)[j]);
+    float dy = sigmoid(feat.channel(c + 1).row(i)[j]);
+    float dw = sigmoid(feat.channel(c + 2).row(i)[j]);
+    float dh = sigmoid(feat.channel(c + 3).row(i)[j]);
+
+    float pb_cx = (dx * 2.f - 0.5f + j) * stride;
+    float pb_cy = (dy * 2.f - 0.5f + i) * stride;
+
+    float pb_w = pow(dw * 2.f, 2) * anchors[q * 2];
+    float pb_h = pow(dh * 2.f, 2) * anchors[q * 2 + 1];
+
+    float x0 = pb_cx - pb_w * 0.5f;
+    float y0 = pb_cy - pb_h * 0.5f;
+    float x1 = pb_cx + pb_w * 0.5f;
+    float y1 = pb_cy + pb_h * 0.5f;
+
+    Object obj;
+    obj.rect.x = x0;
+    obj.rect.y = y0;
+    obj.rect.width = x1 - x0;
+    obj.rect.height = y1 - y0;
+
+    return obj;
+}
+
+float Yolo::objectness_threshold(float prob_threshold)
+{
+    // sigmoid(box) * sigmoid(class) < sigmoid(box), so a cell needs sigmoid(box) >= prob_threshold,
+    // lowered a little so that rounding of the sigmoids never drops a cell the single pass keeps
+    return prob_threshold > 0 ? logf(prob_threshold / (1 - prob_threshold)) - 1e-3f : -FLT_MAX;
+}
+
+void Yolo::decode_proposals(const ncnn::Mat& feat, const float* anchors, int num_anchors, int stride, int num_classes,
+                            float prob_threshold, std::vector<Object>& objects, const DecodeKernels* kernels, DecodeStats* stats)
+{
+    if (!kernels)
+        kernels = &decode_kernels();
+
+    const int num_grid_x = feat.w;
+    const int num_grid_y = feat.h;
+
+    const float box_threshold = objectness_threshold(prob_threshold);
+
+    std::vector<int> candidates(num_grid_x);
+    std::vector<float> class_score(num_grid_x);
+    std::vector<int> class_index(num_grid_x);
+    size_t num_candidates = 0;
+    size_t num_proposals = objects.size();
+
+    for (int q = 0; q < num_anchors; q++)
+    {
+        const int num_output = q * (num_classes + 5);
+
+        for (int i = 0; i < num_grid_y; i++)
+        {
+            // phase one, objectness only
+            const float* box_score = feat.channel(num_output + 4).row(i);
+            const int n = kernels->compact(box_score, num_grid_x, box_threshold, candidates.data());
+            if (n == 0)
+                continue;
+
+            num_candidates += n;
+
+            // phase two, classes and boxes of the candidates, whole rows with the vector kernel if many pass
+            const float* class_planes = feat.channel(num_output + 5).row(i);
+            const bool dense = n * 4 > num_grid_x;
+            if (dense)
+                kernels->argmax(class_planes, feat.cstep, num_classes, num_grid_x, class_score.data(), class_index.data());
+
+            for (int c = 0; c < n; c++)
+            {
+                const int j = candidates[c];
+                if (!dense)
+                    argmax_block<1>(class_planes + j, feat.cstep, num_classes, &class_score[j], &class_index[j]);
+
+                float confidence = sigmoid(box_score[j]) * sigmoid(class_score[j]);
+                if (confidence < prob_threshold)
+                    continue;
+
+                Object obj = decode_box(feat, num_output, i, j, anchors, q, stride);
+                obj.label = class_index[j];
+                obj.prob = confidence;
+
+                objects.push_back(obj);
+            }
+        }
+    }
+
+    if (stats)
+    {
+        stats->cells += (size_t)num_anchors * num_grid_x * num_grid_y;
+        stats->candidates += num_candidates;
+        stats->proposals += objects.size() - num_proposals;
+    }
+}
+
+void Yolo::decode_proposals_rows(const ncnn::Mat& feat, const float* anchors, int num_anchors, int stride, int num_classes,
+                                 float prob_threshold, std::vector<Object>& objects, const DecodeKernels* kernels)
+{
+    if (!kernels)
+        kernels = &decode_kernels();
+
+    const int num_grid_x = feat.w;
+    const int num_grid_y = feat.h;
+
+    std::vector<float> class_score(num_grid_x);
+    std::vector<int> class_index(num_grid_x);
+
+    for (int q = 0; q < num_anchors; q++)
+    {
+        const int num_output = q * (num_classes + 5);
+
+        for (int i = 0; i < num_grid_y; i++)
+        {
+            kernels->argmax(feat.channel(num_output + 5).row(i), feat.cstep, num_classes, num_grid_x,
+                            class_score.data(), class_index.data());
+
+            const float* box_score = feat.channel(num_output + 4).row(i);
+            for (int j = 0; j < num_grid_x; j++)
+            {
+                float confidence = sigmoid(box_score[j]) * sigmoid(class_score[j]);
+                if (confidence < prob_threshold)
+                    continue;
+
+                Object obj = decode_box(feat, num_output, i, j, anchors, q, stride);
+                obj.label = class_index[j];
+                obj.prob = confidence;
+
+                objects.push_back(obj);
+            }
+        }
+    }
+}
+
+void Yolo::decode_proposals_strided(const ncnn::Mat& feat, const float* anchors, int num_anchors, int stride, int num_classes,
+                                    float prob_threshold, std::vector<Object>& objects)
+{
+    for (int q = 0; q < num_anchors; q++)
+    {
+        const int num_output = q * (num_classes + 5);
+
+        for (int i = 0; i < feat.h; i++)
+        {
+            for (int j = 0; j < feat.w; j++)
+            {
+                // find class index with max class score
+                int class_index = 0;
+                float class_score = -FLT_MAX;
+                for (int k = 0; k < num_classes; k++)
+                {
+                    float score = feat.channel(num_output + 5 + k).row(i)[j];
+                    if (score > class_score)
+                    {
+                        class_index = k;
+                        class_score = score;
+                    }
+                }
+
+                float box_score = feat.channel(num_output + 4).row(i)[j];
+                float confidence = sigmoid(box_score) * sigmoid(class_score);
+                if (confidence >= prob_threshold)
+                {
+                    Object obj = decode_box(feat, num_output, i, j, anchors, q, stride);
+                    obj.label = class_index;
+                    obj.prob = confidence;
+
+                    objects.push_back(obj);
+                }
+            }
+        }
+    }
+}
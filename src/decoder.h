@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_DECODER_H
+#define NCNN_YOLO_DECODER_H
+
+#include "YoloV7.h"
+#include "mat.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace Yolo {
+
+    /// Row kernels of the detection head decoder, vectorized with RVV or NEON where the build and the CPU support it
+    struct DecodeKernels {
+        const char* name;
+
+        /// Largest value and its plane index for `n` consecutive cells over `num_planes` planes `cstep` floats apart,
+        /// the first plane wins ties
+        void (*argmax)(const float* planes, size_t cstep, int num_planes, int n, float* max_value, int* max_index);
+        /// Writes the indexes of the values in `row` that are at least `threshold` to `indexes`
+        /// @return Number of indexes written
+        int (*compact)(const float* row, int n, float threshold, int* indexes);
+    };
+
+    /// Cells visited by `decode_proposals`, every anchor of a cell counts once
+    struct DecodeStats {
+        size_t cells{};
+        size_t candidates{};        // passed the objectness threshold and had their classes compared
+        size_t proposals{};         // passed the confidence threshold
+    };
+
+    /// @brief Fastest kernels for this CPU, selected once at runtime
+    const DecodeKernels& decode_kernels();
+
+    /// @brief Portable scalar kernels, the fallback if no vector extension is available
+    const DecodeKernels& scalar_decode_kernels();
+
+    /// @brief Smallest objectness logit of a cell that can reach `prob_threshold` with any class
+    float objectness_threshold(float prob_threshold);
+
+    /// @brief Decodes the boxes of one detection head whose confidence reaches the threshold
+    ///
+    /// Decoding runs in two phases. The objectness row of each anchor is compared with the
+    /// threshold in logit space, a cell whose objectness alone is below it cannot reach it with
+    /// any class, and the indexes of the remaining cells are compacted into a list. Only for
+    /// those the class argmax, the sigmoids and the box are computed.
+    /// @param feat Head output, `num_anchors * (5 + num_classes)` channels of grid rows
+    /// @param anchors Width and height of each anchor in input pixels
+    /// @param num_anchors Number of anchors
+    /// @param stride Input pixels per grid cell
+    /// @param num_classes Number of classes
+    /// @param prob_threshold Smallest objectness times class probability that is kept
+    /// @param objects Decoded boxes in input coordinates are appended
+    /// @param kernels Row kernels, `decode_kernels()` if null
+    /// @param stats Counts of visited cells and candidates are added to it if not null
+    void decode_proposals(const ncnn::Mat &feat,
+                          const float* anchors,
+                          int num_anchors,
+                          int stride,
+                          int num_classes,
+                          float prob_threshold,
+                          std::vector<Object> &objects,
+                          const DecodeKernels* kernels = nullptr,
+                          DecodeStats* stats = nullptr);
+
+    /// @brief Single pass decoder that runs the class argmax for every cell, row by row
+    void decode_proposals_rows(const ncnn::Mat &feat,
+                               const float* anchors,
+                               int num_anchors,
+                               int stride,
+                               int num_classes,
+                               float prob_threshold,
+                               std::vector<Object> &objects,
+                               const DecodeKernels* kernels = nullptr);
+
+    /// @brief Reference decoder that reads the class scores of one cell after the other from strided planes
+    void decode_proposals_strided(const ncnn::Mat &feat,
+                                  const float* anchors,
+                                  int num_anchors,
+                                  int stride,
+                                  int num_classes,
+                                  float prob_threshold,
+                                  std::vector<Object> &objects);
+}
+
+#endif //NCNN_YOLO_DECODER_H
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "detect_queue.h"
+
+#include <benchmark.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace Yolo;
+
+DetectQueue::DetectQueue(DetectFunction detect, const AsyncOptions& options)
+    : detect(std::move(detect)), options(options), stopping(false), total_wait(0)
+{
+    for (int i = 0; i < this->options.num_workers; i++)
+        this->workers.emplace_back(&DetectQueue::run, this);
+}
+
+DetectQueue::~DetectQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->not_empty.notify_all();
+    this->not_full.notify_all();
+
+    for (std::thread& worker : this->workers)
+        worker.join();
+}
+
+std::future<std::vector<Object>> DetectQueue::submit(const cv::Mat& bgr)
+{
+    Job job;
+    job.bgr = bgr;
+    std::future<std::vector<Object>> result = job.result.get_future();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->counters.submitted++;
+
+    if ((int)this->jobs.size() >= this->options.queue_size)
+    {
+        if (this->options.overload == OverloadPolicy::Reject)
+        {
+            this->counters.rejected++;
+            lock.unlock();
+            job.result.set_exception(std::make_exception_ptr(std::runtime_error("detection queue full, frame rejected")));
+            return result;
+        }
+
+        if (this->options.overload == OverloadPolicy::DropOldest)
+        {
+            // the oldest frame is the most outdated one, the new frame takes its place
+            Job oldest = std::move(this->jobs.front());
+            this->jobs.pop_front();
+            this->counters.dropped++;
+            oldest.result.set_exception(std::make_exception_ptr(std::runtime_error("frame dropped for a newer one")));
+        }
+        else
+        {
+            this->not_full.wait(lock, [this]() {
+                return this->stopping || (int)this->jobs.size() < this->options.queue_size;
+            });
+        }
+    }
+
+    if (this->stopping)
+    {
+        lock.unlock();
+        job.result.set_exception(std::make_exception_ptr(std::runtime_error("detection queue stopped")));
+        return result;
+    }
+
+    job.submit_time = ncnn::get_current_time();
+    this->jobs.push_back(std::move(job));
+    this->counters.max_queue_depth = std::max(this->counters.max_queue_depth, (int)this->jobs.size());
+    lock.unlock();
+
+    this->not_empty.notify_one();
+
+    return result;
+}
+
+AsyncStats DetectQueue::stats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    AsyncStats stats = this->counters;
+    stats.queue_depth = (int)this->jobs.size();
+    stats.avg_wait = stats.started ? this->total_wait / stats.started : 0;
+
+    return stats;
+}
+
+void DetectQueue::run()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->not_empty.wait(lock, [this]() {
+                return this->stopping || !this->jobs.empty();
+            });
+
+            // queued frames are still detected when stopping
+            if (this->jobs.empty())
+                return;
+
+            job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+
+            double wait = ncnn::get_current_time() - job.submit_time;
+            this->counters.started++;
+            this->total_wait += wait;
+            this->counters.max_wait = std::max(this->counters.max_wait, wait);
+        }
+        this->not_full.notify_one();
+
+        std::vector<Object> objects;
+        if (this->detect(job.bgr, objects))
+        {
+            job.result.set_exception(std::make_exception_ptr(std::runtime_error("detection failed")));
+            continue;
+        }
+
+        // counted and released before the caller sees the result
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->counters.completed++;
+        }
+        job.bgr.release();
+        job.result.set_value(std::move(objects));
+    }
+}
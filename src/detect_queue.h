@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_DETECT_QUEUE_H
+#define NCNN_YOLO_DETECT_QUEUE_H
+
+#include "YoloV7.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Yolo {
+
+    /// @brief Bounded queue of frames detected by a pool of worker threads, see `YoloV7::detect_async`
+    ///
+    /// Frames are taken in submission order. Each worker runs one detection at a time,
+    /// so with the worker pools of the detector every worker keeps its own allocators.
+    class DetectQueue {
+    public:
+        using DetectFunction = std::function<int(const cv::Mat &bgr, std::vector<Object> &objects)>;
+
+        /// @param detect Detection run by the workers, must be safe to call concurrently
+        /// @param options Number of workers, queue size and overload policy
+        DetectQueue(DetectFunction detect,
+                    const AsyncOptions &options);
+
+        /// Detects the frames still queued and joins the workers
+        ~DetectQueue();
+
+        /// @brief Queues a frame, or applies the overload policy if the queue is full
+        /// @param bgr Input image in BGR format, referenced until its future is ready
+        /// @return Future of the detections, `get` throws `std::runtime_error` if the frame
+        /// was rejected, dropped or the detection failed
+        std::future<std::vector<Object>> submit(const cv::Mat &bgr);
+
+        AsyncStats stats() const;
+
+    private:
+        struct Job {
+            cv::Mat bgr;
+            double submit_time{};
+            std::promise<std::vector<Object>> result;
+        };
+
+        DetectQueue(const DetectQueue&);
+        DetectQueue& operator=(const DetectQueue&);
+
+        void run();
+
+        DetectFunction detect;
+        AsyncOptions options;
+
+        mutable std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<Job> jobs;
+        bool stopping;
+        AsyncStats counters;
+        double total_wait;
+
+        std::vector<std::thread> workers;
+    };
+}
+
+#endif //NCNN_YOLO_DETECT_QUEUE_H
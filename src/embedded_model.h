@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_EMBEDDED_MODEL_H
+#define NCNN_YOLO_EMBEDDED_MODEL_H
+
+#include <cstddef>
+
+#if YOLOV7_EMBEDDED_MODEL
+
+// Model bundle linked into the executable, see src/embedded_model.S.in
+extern "C" const unsigned char yolov7_embedded_model[];
+extern "C" const unsigned char yolov7_embedded_model_end[];
+
+namespace Yolo {
+
+    /// @brief Size of the embedded model bundle in bytes
+    inline size_t embedded_model_size()
+    {
+        return yolov7_embedded_model_end - yolov7_embedded_model;
+    }
+}
+
+#endif // YOLOV7_EMBEDDED_MODEL
+
+#endif //NCNN_YOLO_EMBEDDED_MODEL_H
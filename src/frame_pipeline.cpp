@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "frame_pipeline.h"
+
+#include <benchmark.h>
+#include <cpu.h>
+#if defined __linux__
+#include <sched.h>
+#endif
+
+#include <chrono>
+
+using namespace Yolo;
+
+/// Spins briefly, then backs off, so an idle stage does not burn its core
+template<typename F>
+static void wait_until(F done)
+{
+    for (int spins = 0; !done(); spins++)
+    {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+template<typename T>
+static void push(SpscRing<T>& ring, const T& value)
+{
+    wait_until([&]() { return ring.try_push(value); });
+}
+
+template<typename T>
+static T pop(SpscRing<T>& ring)
+{
+    T value{};
+    wait_until([&]() { return ring.try_pop(value); });
+    return value;
+}
+
+static void pin_current_thread(int cpu)
+{
+#if defined __linux__
+    if (cpu < 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set))
+        fprintf(stderr, "pinning a pipeline stage to cpu %d failed\n", cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+FramePipeline::FramePipeline(YoloV7& detector, int depth)
+    : detector(detector), slots(depth > 0 ? depth : 1), free_slots(slots.size()), to_preprocess(slots.size()),
+      to_infer(slots.size()), to_postprocess(slots.size()), next_id(0), restore_threading(false), running(false)
+{
+    for (Slot& slot : this->slots)
+        this->free_slots.try_push(&slot);
+}
+
+FramePipeline::~FramePipeline()
+{
+    stop();
+}
+
+int FramePipeline::start(Callback callback, const std::vector<int>& cpus)
+{
+    if (this->running)
+    {
+        fprintf(stderr, "pipeline is already running\n");
+        return -1;
+    }
+
+    int stage_cpus[3] = {-1, -1, -1};
+    for (size_t i = 0; i < cpus.size() && i < 3; i++)
+    {
+        if (cpus[i] >= ncnn::get_cpu_count())
+        {
+            fprintf(stderr, "cpu %d does not exist\n", cpus[i]);
+            return -1;
+        }
+        stage_cpus[i] = cpus[i];
+    }
+
+    // the detector re-pins the OpenMP team of the inference thread on its first frame,
+    // so that core becomes the affinity of the detector instead of a pin of the thread
+    if (stage_cpus[1] >= 0)
+    {
+        ThreadOptions threading = this->detector.threading_options();
+        if (threading.affinity.num_enabled() > 0 || threading.powersave != 0)
+        {
+            fprintf(stderr, "detector has its own affinity, no cpu for the inference stage allowed\n");
+            return -1;
+        }
+
+        ThreadOptions pinned = threading;
+        pinned.affinity.enable(stage_cpus[1]);
+        if (this->detector.set_threading(pinned))
+            return -1;
+
+        this->saved_threading = threading;
+        this->restore_threading = true;
+    }
+
+    this->callback = callback;
+    this->running = true;
+
+    this->preprocess_thread = std::thread(&FramePipeline::run_preprocess, this, stage_cpus[0]);
+    this->infer_thread = std::thread(&FramePipeline::run_infer, this);
+    this->postprocess_thread = std::thread(&FramePipeline::run_postprocess, this, stage_cpus[2]);
+
+    return 0;
+}
+
+int FramePipeline::submit(const cv::Mat& bgr)
+{
+    if (!this->running)
+        return -1;
+
+    Slot* slot = pop(this->free_slots);
+    slot->id = this->next_id++;
+    slot->bgr = bgr;
+    slot->submit_time = ncnn::get_current_time();
+    slot->failed = false;
+
+    push(this->to_preprocess, slot);
+
+    return 0;
+}
+
+void FramePipeline::stop()
+{
+    if (!this->running)
+        return;
+
+    // the end marker runs behind the last frame through every stage
+    push(this->to_preprocess, (Slot*)nullptr);
+
+    this->preprocess_thread.join();
+    this->infer_thread.join();
+    this->postprocess_thread.join();
+
+    if (this->restore_threading)
+    {
+        this->detector.set_threading(this->saved_threading);
+        this->restore_threading = false;
+    }
+
+    this->running = false;
+}
+
+bool FramePipeline::is_running() const
+{
+    return this->running;
+}
+
+void FramePipeline::run_preprocess(int cpu)
+{
+    pin_current_thread(cpu);
+
+    for (;;)
+    {
+        Slot* slot = pop(this->to_preprocess);
+        if (slot && !slot->failed)
+            slot->failed = this->detector.preprocess(slot->bgr, slot->state) != 0;
+
+        push(this->to_infer, slot);
+
+        if (!slot)
+            break;
+    }
+}
+
+void FramePipeline::run_infer()
+{
+    for (;;)
+    {
+        Slot* slot = pop(this->to_infer);
+        if (slot && !slot->failed)
+            slot->failed = this->detector.infer(slot->state) != 0;
+
+        push(this->to_postprocess, slot);
+
+        if (!slot)
+            break;
+    }
+}
+
+void FramePipeline::run_postprocess(int cpu)
+{
+    pin_current_thread(cpu);
+
+    for (;;)
+    {
+        Slot* slot = pop(this->to_postprocess);
+        if (!slot)
+            break;
+
+        slot->objects.clear();
+        if (!slot->failed)
+            this->detector.postprocess(slot->state, slot->objects);
+
+        if (this->callback)
+            this->callback(slot->id, slot->bgr, slot->objects, ncnn::get_current_time() - slot->submit_time);
+
+        slot->bgr.release();
+        push(this->free_slots, slot);
+    }
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_FRAME_PIPELINE_H
+#define NCNN_YOLO_FRAME_PIPELINE_H
+
+#include "YoloV7.h"
+#include "spsc_ring.h"
+
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Yolo {
+
+    /// @brief Streams frames through preprocessing, inference and postprocessing on three threads
+    ///
+    /// While frame N is in the network, frame N+1 is letterboxed and frame N-1 is decoded and
+    /// handed to the callback. The stages pass fixed frame slots through lock-free single
+    /// producer, single consumer rings, and the slots return to `submit` through a fourth ring,
+    /// so the input buffers and outputs of a slot are reused and nothing is allocated per frame.
+    class FramePipeline {
+    public:
+        /// Called on the postprocessing thread for every frame in submission order,
+        /// `objects` is empty if a stage failed, `latency` is the time from `submit` in ms
+        using Callback = std::function<void(uint64_t frame_id,
+                                            const cv::Mat &bgr,
+                                            const std::vector<Object> &objects,
+                                            double latency)>;
+
+        /// @param detector Initialized detector, must outlive the pipeline
+        /// @param depth Number of frames in flight
+        explicit FramePipeline(YoloV7 &detector,
+                               int depth = 4);
+        ~FramePipeline();
+
+        /// @brief Starts the stage threads
+        ///
+        /// The preprocessing and postprocessing threads are pinned directly. The detector re-pins the
+        /// OpenMP threads of every inference thread to its `ThreadOptions`, so the inference core is
+        /// set as the detector's affinity until `stop` restores the previous options. It must not be
+        /// combined with a detector that has an affinity or power saving policy of its own, or with more
+        /// than one inference thread. Other threads detecting with the same detector are pinned as well.
+        /// @param callback Receives the detections of every frame
+        /// @param cpus Cores of the preprocessing, inference and postprocessing thread, `-1` or empty for no pinning
+        /// @return `0` on success, `-1` if already running, a core does not exist or the inference core
+        /// conflicts with the detector's threading options
+        int start(Callback callback,
+                  const std::vector<int> &cpus = std::vector<int>());
+
+        /// @brief Queues a frame, blocks while `depth` frames are in flight. Must always be called from the same thread.
+        /// @param bgr Input image in BGR format, referenced until its callback returns
+        /// @return `0` on success, `-1` if the pipeline is not running
+        int submit(const cv::Mat &bgr);
+
+        /// @brief Finishes all submitted frames and joins the stage threads
+        void stop();
+
+        bool is_running() const;
+
+    private:
+        struct Slot {
+            uint64_t id{};
+            cv::Mat bgr;
+            double submit_time{};
+            bool failed{};
+            DetectionState state;
+            std::vector<Object> objects;
+        };
+
+        FramePipeline(const FramePipeline&);
+        FramePipeline& operator=(const FramePipeline&);
+
+        void run_preprocess(int cpu);
+        void run_infer();
+        void run_postprocess(int cpu);
+
+        YoloV7& detector;
+        Callback callback;
+        std::vector<Slot> slots;
+        SpscRing<Slot*> free_slots;         // postprocessing -> submit
+        SpscRing<Slot*> to_preprocess;      // submit -> preprocessing
+        SpscRing<Slot*> to_infer;           // preprocessing -> inference
+        SpscRing<Slot*> to_postprocess;     // inference -> postprocessing
+        std::thread preprocess_thread;
+        std::thread infer_thread;
+        std::thread postprocess_thread;
+        uint64_t next_id;
+        ThreadOptions saved_threading;      // detector options before the inference core was set
+        bool restore_threading;
+        bool running;
+    };
+}
+
+#endif //NCNN_YOLO_FRAME_PIPELINE_H
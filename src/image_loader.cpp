@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "image_loader.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+
+#if YOLOV7_WITH_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+using namespace Yolo;
+
+#if YOLOV7_WITH_LIBJPEG
+/// libjpeg exits the process on errors by default, jump back into the loader instead
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegError* err = (JpegError*)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+/// @return `0` on success, `-1` if the file is not a JPEG, uses another color space or is corrupt
+static int load_jpeg_scaled(FILE* fp, int min_size, ScaledImage& image)
+{
+    jpeg_decompress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+
+    // only trivially destructible locals are skipped by the longjmp, the image is owned by the caller
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK ||
+        (cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_GRAYSCALE && cinfo.jpeg_color_space != JCS_RGB))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+
+    // largest reduction whose long side does not fall below min_size
+    const int long_side = std::max(cinfo.image_width, cinfo.image_height);
+    int denom = 8;
+    while (denom > 1 && (long_side + denom - 1) / denom < min_size)
+        denom /= 2;
+
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    cinfo.dct_method = JDCT_IFAST;
+#ifdef JCS_EXTENSIONS
+    cinfo.out_color_space = JCS_EXT_BGR;
+#else
+    cinfo.out_color_space = JCS_RGB;
+#endif
+
+    jpeg_start_decompress(&cinfo);
+
+    image.width = cinfo.image_width;
+    image.height = cinfo.image_height;
+    image.bgr = cv::Mat(cinfo.output_height, cinfo.output_width, CV_8UC3);
+
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = image.bgr.data + cinfo.output_scanline * cinfo.output_width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+
+#ifndef JCS_EXTENSIONS
+        for (unsigned int x = 0; x < cinfo.output_width; x++)
+            std::swap(row[x * 3], row[x * 3 + 2]);
+#endif
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return 0;
+}
+#endif
+
+int Yolo::load_image_scaled(const char* path, int min_size, ScaledImage& image)
+{
+#if YOLOV7_WITH_LIBJPEG
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    int ret = load_jpeg_scaled(fp, min_size, image);
+    fclose(fp);
+
+    // anything libjpeg cannot decode is left to cv::imread
+    if (ret == 0)
+        return 0;
+#else
+    (void)min_size;
+#endif
+
+    image.bgr = cv::imread(path, 1);
+    if (image.bgr.empty())
+    {
+        fprintf(stderr, "cv::imread %s failed\n", path);
+        return -1;
+    }
+
+    image.width = image.bgr.cols;
+    image.height = image.bgr.rows;
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_IMAGE_LOADER_H
+#define NCNN_YOLO_IMAGE_LOADER_H
+
+#include "simpleocv.h"
+
+namespace Yolo {
+
+    /// Image decoded at a reduced size together with the size of the original
+    struct ScaledImage {
+        cv::Mat bgr;
+        int width{};        // original image
+        int height{};
+
+        /// Decoded size relative to the original size, `1` if decoded at full size
+        float scale() const { return width > 0 ? (float)bgr.cols / width : 1.f; }
+    };
+
+    /// @brief Loads an image at the smallest size whose long side is still at least `min_size`
+    ///
+    /// JPEGs are scaled by 1/2, 1/4 or 1/8 in the DCT domain while decoding if the build has libjpeg,
+    /// which skips most of the work for large stills. Other images are decoded at full size.
+    /// @param path Path to the image file
+    /// @param min_size Smallest long side of the decoded image, usually the network input size
+    /// @param image Decoded BGR image and original size
+    /// @return `0` on success, `-1` if the image cannot be read
+    int load_image_scaled(const char* path,
+                          int min_size,
+                          ScaledImage &image);
+}
+
+#endif //NCNN_YOLO_IMAGE_LOADER_H
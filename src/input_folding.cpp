@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "input_folding.h"
+#include "layer.h"
+#include "mat.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace Yolo;
+
+// storage tags at the start of a weight blob, see ncnn's ModelBinFromDataReader
+static const unsigned int TAG_FLOAT32 = 0;
+static const unsigned int TAG_FLOAT16 = 0x01306B47;
+
+InputScaleFoldingReader::InputScaleFoldingReader(const ncnn::DataReader& dr, float scale)
+    : dr(dr), scale(scale), state(TAG), float16(false), scaled(false)
+{
+}
+
+bool InputScaleFoldingReader::can_fold(const ncnn::Net& net)
+{
+    const std::vector<ncnn::Layer*>& layers = net.layers();
+    if (layers.size() < 2 || layers[0]->type != "Input" || layers[0]->tops.size() != 1)
+        return false;
+
+    // the convolution must directly follow the input, it then also owns the first weights of the file
+    const int input_blob = layers[0]->tops[0];
+    const ncnn::Layer* conv = layers[1];
+    if (conv->type != "Convolution" || conv->bottoms.size() != 1 || conv->bottoms[0] != input_blob)
+        return false;
+
+    // any other consumer would see the unnormalized input
+    for (size_t i = 2; i < layers.size(); i++)
+    {
+        for (int bottom : layers[i]->bottoms)
+        {
+            if (bottom == input_blob)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool InputScaleFoldingReader::folded() const
+{
+    return this->scaled;
+}
+
+size_t InputScaleFoldingReader::read(void* buf, size_t size) const
+{
+    if (this->state == TAG && size == sizeof(unsigned int))
+    {
+        unsigned int tag;
+        size_t nread = this->dr.read(&tag, sizeof(tag));
+        if (nread != sizeof(tag))
+            return nread;
+
+        if (tag == TAG_FLOAT32 || tag == TAG_FLOAT16)
+        {
+            // float16 is handed to ncnn as float32, the scaled weights would underflow in half precision
+            this->float16 = tag == TAG_FLOAT16;
+            this->state = WEIGHTS;
+            tag = TAG_FLOAT32;
+        }
+        else
+        {
+            this->state = DONE;
+        }
+
+        memcpy(buf, &tag, sizeof(tag));
+        return nread;
+    }
+
+    if (this->state == WEIGHTS)
+    {
+        this->state = DONE;
+
+        const size_t n = size / sizeof(float);
+        float* weights = (float*)buf;
+
+        if (this->float16)
+        {
+            // float16 blobs are padded to 4 bytes
+            std::vector<unsigned short> half((n * sizeof(unsigned short) + 3) / 4 * 2);
+            size_t nread = this->dr.read(half.data(), half.size() * sizeof(unsigned short));
+            if (nread != half.size() * sizeof(unsigned short))
+                return 0;
+
+            for (size_t i = 0; i < n; i++)
+                weights[i] = ncnn::float16_to_float32(half[i]) * this->scale;
+        }
+        else
+        {
+            size_t nread = this->dr.read(buf, size);
+            if (nread != size)
+                return nread;
+
+            for (size_t i = 0; i < n; i++)
+                weights[i] *= this->scale;
+        }
+
+        this->scaled = true;
+        return size;
+    }
+
+    this->state = DONE;
+    return this->dr.read(buf, size);
+}
+
+size_t InputScaleFoldingReader::reference(size_t size, const void** buf) const
+{
+    // the weights are modified, they must be copied through read
+    if (this->state == WEIGHTS)
+        return 0;
+
+    return this->dr.reference(size, buf);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_INPUT_FOLDING_H
+#define NCNN_YOLO_INPUT_FOLDING_H
+
+#include "datareader.h"
+#include "net.h"
+
+#include <cstddef>
+
+namespace Yolo {
+
+    /// @brief ncnn DataReader that scales the weights of the first convolution while they are loaded
+    ///
+    /// A convolution is linear in its input, so scaling its weights by the input normalization
+    /// (1/255) gives the same output for unnormalized 0..255 pixels and the normalization pass
+    /// can be dropped. The first blob of the model file is rewritten: float16 weights are
+    /// widened to float32 before scaling so small weights do not lose precision, quantized
+    /// weights are passed through unchanged and `folded` stays `false`.
+    /// Everything after the first weight blob is forwarded untouched, including references.
+    class InputScaleFoldingReader : public ncnn::DataReader {
+    public:
+        /// @param dr Reader of the model file, positioned at its start
+        /// @param scale Factor applied to the first convolution's weights
+        InputScaleFoldingReader(const ncnn::DataReader &dr,
+                                float scale);
+
+        /// @brief Checks whether the first weights of the model belong to a convolution that is the only consumer of the input
+        /// @param net Network with the param loaded and the model not yet loaded
+        static bool can_fold(const ncnn::Net &net);
+
+        /// @brief Whether the weights were scaled, valid after `load_model`
+        bool folded() const;
+
+        size_t read(void* buf, size_t size) const override;
+
+        size_t reference(size_t size, const void** buf) const override;
+
+    private:
+        // position in the first weight blob
+        enum State {
+            TAG,        // before the storage tag
+            WEIGHTS,    // tag read, the weights are next
+            DONE        // forwarding
+        };
+
+        const ncnn::DataReader& dr;
+        const float scale;
+        mutable State state;
+        mutable bool float16;
+        mutable bool scaled;
+    };
+}
+
+#endif //NCNN_YOLO_INPUT_FOLDING_H
@@ -7,37 +7,60 @@
 
 #include "simpleocv.h"
 #include "YoloV7.h"
+#include "embedded_model.h"
 
 using namespace Yolo;
 
 int main(int argc, char** argv)
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
-        fprintf(stderr, "Usage: %s [imagepath]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [imagepath] [bundlepath]\n", argv[0]);
         return -1;
     }
 
     char* imagepath = argv[1];
 
-    // Load image
-    cv::Mat m = cv::imread(imagepath, 1);
-    if (m.empty())
+    // Create YOLOv7 object for inference, anchors are from YOLOv7's autoanchor function
+    // A bundle carries its own anchors, thresholds and class labels
+    std::vector<float> anchors = {12, 16, 19, 36, 40, 28, 36, 75, 76, 55, 72, 146, 142, 110, 192, 243, 459, 401};
+#if YOLOV7_EMBEDDED_MODEL
+    // Builds with EMBED_MODEL=ON use the bundle linked into the executable unless a bundle file is given
+    YoloV7 yolov7 = argc == 3 ? YoloV7(argv[2]) : YoloV7(yolov7_embedded_model, embedded_model_size());
+#else
+    YoloV7 yolov7 = argc == 3 ? YoloV7(argv[2]) : YoloV7(640, 80, 0.25, 0.5, anchors);
+#endif
+
+    // Load the network once, it is kept for the lifetime of the object
+    if (yolov7.init())
     {
-        fprintf(stderr, "cv::imread %s failed\n", imagepath);
         return -1;
     }
 
-    // Create YOLOv7 object for inference, anchors are from YOLOv7's autoanchor function
-    std::vector<float> anchors = {12, 16, 19, 36, 40, 28, 36, 75, 76, 55, 72, 146, 142, 110, 192, 243, 459, 401};
-    YoloV7 yolov7 = YoloV7(640, 80, 0.25, 0.5, anchors);
+    // Load image, large JPEGs are decoded straight at a size close to the network input
+    ScaledImage image;
+    if (yolov7.load_image(imagepath, image))
+    {
+        return -1;
+    }
 
-    // Perform inference
+    // Perform inference, detections are in original image coordinates
     std::vector<Object> objects;
-    yolov7.detect(m, objects);
+    if (yolov7.detect(image, objects))
+    {
+        return -1;
+    }
 
-    // Create output image with bounding boxes
-    yolov7.draw_objects(m, objects);
+    // Create output image with bounding boxes on the decoded image
+    std::vector<Object> drawn = objects;
+    for (Object& obj : drawn)
+    {
+        obj.rect.x *= image.scale();
+        obj.rect.y *= image.scale();
+        obj.rect.width *= image.scale();
+        obj.rect.height *= image.scale();
+    }
+    yolov7.draw_objects(image.bgr, drawn);
 
     // Optionally write detection results to file
     yolov7.write_objects(objects, imagepath);
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "mmap_datareader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+using namespace Yolo;
+
+MmapDataReader::MmapDataReader() : mem(nullptr), mem_size(0), offset(0)
+{
+}
+
+MmapDataReader::~MmapDataReader()
+{
+    close();
+}
+
+int MmapDataReader::open(const char* path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "open %s failed\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0)
+    {
+        fprintf(stderr, "fstat %s failed\n", path);
+        ::close(fd);
+        return -1;
+    }
+
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+
+    if (ptr == MAP_FAILED)
+    {
+        fprintf(stderr, "mmap %s failed\n", path);
+        return -1;
+    }
+
+    // weights are consumed front to back exactly once during load_model
+    madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+
+    this->mem = (const unsigned char*)ptr;
+    this->mem_size = st.st_size;
+    this->offset = 0;
+
+    return 0;
+}
+
+void MmapDataReader::close()
+{
+    if (this->mem)
+    {
+        munmap((void*)this->mem, this->mem_size);
+    }
+
+    this->mem = nullptr;
+    this->mem_size = 0;
+    this->offset = 0;
+}
+
+const unsigned char* MmapDataReader::data() const
+{
+    return this->mem;
+}
+
+size_t MmapDataReader::size() const
+{
+    return this->mem_size;
+}
+
+size_t MmapDataReader::read(void* buf, size_t size) const
+{
+    size_t remain = this->mem_size - this->offset;
+    if (size > remain)
+        size = remain;
+
+    memcpy(buf, this->mem + this->offset, size);
+    this->offset += size;
+
+    return size;
+}
+
+size_t MmapDataReader::reference(size_t size, const void** buf) const
+{
+    // ncnn falls back to read() when less than size is referenced
+    if (size > this->mem_size - this->offset)
+        return 0;
+
+    *buf = this->mem + this->offset;
+    this->offset += size;
+
+    return size;
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_MMAP_DATAREADER_H
+#define NCNN_YOLO_MMAP_DATAREADER_H
+
+#include "datareader.h"
+
+#include <cstddef>
+
+namespace Yolo {
+
+    /// @brief ncnn DataReader on top of a read-only memory mapped file
+    ///
+    /// `reference` hands out pointers into the mapping, so float32 weights that
+    /// need no repacking are never copied to the heap. The pages are file backed
+    /// and shared between all processes mapping the same model file.
+    /// The mapping must outlive every `ncnn::Net` loaded from it.
+    class MmapDataReader : public ncnn::DataReader {
+    public:
+        MmapDataReader();
+        ~MmapDataReader() override;
+
+        /// @brief Maps a file and resets the read position to its start
+        /// @param path Path to the file
+        /// @return `0` on success, `-1` if the file could not be opened or mapped
+        int open(const char* path);
+
+        /// @brief Unmaps the file, all references handed out become invalid
+        void close();
+
+        /// @brief Start of the mapping, `nullptr` if no file is mapped
+        const unsigned char* data() const;
+
+        /// @brief Size of the mapping in bytes
+        size_t size() const;
+
+        size_t read(void* buf, size_t size) const override;
+
+        size_t reference(size_t size, const void** buf) const override;
+
+    private:
+        MmapDataReader(const MmapDataReader&);
+        MmapDataReader& operator=(const MmapDataReader&);
+
+        const unsigned char* mem;
+        size_t mem_size;
+        mutable size_t offset;
+    };
+}
+
+#endif //NCNN_YOLO_MMAP_DATAREADER_H
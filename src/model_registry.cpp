@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "model_registry.h"
+
+using namespace Yolo;
+
+ModelRegistry::ModelRegistry()
+{
+}
+
+int ModelRegistry::add(const std::string& id, std::unique_ptr<YoloV7> detector)
+{
+    if (!detector || this->detectors.count(id))
+    {
+        fprintf(stderr, "model id %s is already registered\n", id.c_str());
+        return -1;
+    }
+
+    // reuse a loaded network of the same model files if there is one
+    const std::string source = detector->model_source();
+    const YoloV7* same_model = nullptr;
+    for (const auto& entry : this->detectors)
+    {
+        if (entry.second->model_source() == source)
+        {
+            same_model = entry.second.get();
+            break;
+        }
+    }
+
+    if (!same_model || detector->share_model(*same_model))
+    {
+        if (detector->init())
+            return -1;
+
+        this->networks++;
+    }
+
+    // PoolAllocator locks, so detections on different models may run concurrently
+    detector->set_allocators(&this->blob_pool, &this->workspace_pool);
+
+    this->detectors[id] = std::move(detector);
+
+    return 0;
+}
+
+YoloV7* ModelRegistry::get(const std::string& id) const
+{
+    auto it = this->detectors.find(id);
+    return it == this->detectors.end() ? nullptr : it->second.get();
+}
+
+std::vector<std::string> ModelRegistry::ids() const
+{
+    std::vector<std::string> ids;
+    for (const auto& entry : this->detectors)
+        ids.push_back(entry.first);
+    return ids;
+}
+
+int ModelRegistry::detect(const std::string& id, const cv::Mat& bgr, std::vector<Object>& objects)
+{
+    YoloV7* detector = get(id);
+    if (!detector)
+    {
+        fprintf(stderr, "model id %s is not registered\n", id.c_str());
+        return -1;
+    }
+
+    return detector->detect(bgr, objects);
+}
+
+int ModelRegistry::num_networks() const
+{
+    return this->networks;
+}
+
+void ModelRegistry::clear_pools()
+{
+    this->blob_pool.clear();
+    this->workspace_pool.clear();
+}
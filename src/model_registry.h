@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_MODEL_REGISTRY_H
+#define NCNN_YOLO_MODEL_REGISTRY_H
+
+#include "YoloV7.h"
+#include "allocator.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Yolo {
+
+    /// @brief Named detectors that share one blob and one workspace pool allocator
+    ///
+    /// Detectors added with the same model source, e.g. the same weights at another target
+    /// size, share one loaded network instead of holding a second copy of the packed weights.
+    class ModelRegistry {
+    public:
+        ModelRegistry();
+
+        /// @brief Registers and initializes a detector
+        /// @param id Name used to select the detector in `detect`
+        /// @param detector Configured detector, `init` is called here unless its network can be shared
+        /// @return `0` on success, `-1` if the id is taken or the model could not be loaded
+        int add(const std::string &id,
+                std::unique_ptr<YoloV7> detector);
+
+        /// @brief Detector registered under an id
+        /// @return Detector, `nullptr` if there is none
+        YoloV7* get(const std::string &id) const;
+
+        /// @brief Ids of all registered detectors
+        std::vector<std::string> ids() const;
+
+        /// @brief Performs inference with the detector registered under an id
+        /// @param id Detector id
+        /// @param bgr Input image in BGR format
+        /// @param objects Vector of predicted object detections
+        /// @return `0` on success, `-1` if the id is unknown or the detection failed
+        int detect(const std::string &id,
+                   const cv::Mat &bgr,
+                   std::vector<Object> &objects);
+
+        /// @brief Number of networks actually loaded, lower than the number of detectors if some are shared
+        int num_networks() const;
+
+        /// @brief Releases the memory cached by the shared pool allocators
+        void clear_pools();
+
+    private:
+        ModelRegistry(const ModelRegistry&);
+        ModelRegistry& operator=(const ModelRegistry&);
+
+        // declared before the detectors, they must outlive every extractor that uses them
+        ncnn::PoolAllocator blob_pool;
+        ncnn::PoolAllocator workspace_pool;
+
+        std::map<std::string, std::unique_ptr<YoloV7>> detectors;
+        int networks{};
+    };
+}
+
+#endif //NCNN_YOLO_MODEL_REGISTRY_H
@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "prefork_server.h"
+
+#include <benchmark.h>
+#include <cpu.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+
+using namespace Yolo;
+
+enum MessageType : int32_t {
+    MESSAGE_READY = 0,
+    MESSAGE_FRAME = 1,
+    MESSAGE_MEMORY = 2,
+    MESSAGE_EXIT = 3,
+};
+
+struct MessageHeader {
+    int32_t type;
+    int32_t status;
+    int32_t w;
+    int32_t h;
+};
+
+static int send_all(int fd, const void* buf, size_t size)
+{
+    const char* p = (const char*)buf;
+    while (size > 0)
+    {
+        // no SIGPIPE if the other side is gone, the caller gets -1 instead
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void* buf, size_t size)
+{
+    char* p = (char*)buf;
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+SmapsUsage SmapsUsage::current()
+{
+    SmapsUsage usage;
+
+    FILE* fp = fopen("/proc/self/smaps", "r");
+    if (!fp)
+        return usage;
+
+    char line[512];
+    long value;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "Rss: %ld", &value) == 1)
+            usage.rss += value;
+        else if (sscanf(line, "Pss: %ld", &value) == 1)
+            usage.pss += value;
+        else if (sscanf(line, "Shared_Clean: %ld", &value) == 1)
+            usage.shared_clean += value;
+        else if (sscanf(line, "Shared_Dirty: %ld", &value) == 1)
+            usage.shared_dirty += value;
+        else if (sscanf(line, "Private_Clean: %ld", &value) == 1)
+            usage.private_clean += value;
+        else if (sscanf(line, "Private_Dirty: %ld", &value) == 1)
+            usage.private_dirty += value;
+    }
+
+    fclose(fp);
+
+    return usage;
+}
+
+PreforkServer::PreforkServer(YoloV7& detector) : detector(detector)
+{
+}
+
+PreforkServer::~PreforkServer()
+{
+    stop();
+}
+
+int PreforkServer::start(int num_workers, int warmup_w, int warmup_h)
+{
+    stop();
+
+    if (!this->detector.is_initialized())
+    {
+        fprintf(stderr, "PreforkServer needs an initialized detector\n");
+        return -1;
+    }
+
+    // fault in weights, packed pipelines and allocator pools once, before they are shared
+    if (this->detector.warmup(1, warmup_w, warmup_h))
+        return -1;
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+        {
+            fprintf(stderr, "socketpair failed\n");
+            stop();
+            return -1;
+        }
+
+        double start = ncnn::get_current_time();
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            fprintf(stderr, "fork failed\n");
+            close(fds[0]);
+            close(fds[1]);
+            stop();
+            return -1;
+        }
+
+        if (pid == 0)
+        {
+            close(fds[0]);
+            for (const Worker& w : this->workers)
+                close(w.fd);
+
+            serve(fds[1]);
+        }
+
+        close(fds[1]);
+
+        MessageHeader ready;
+        if (recv_all(fds[0], &ready, sizeof(ready)) || ready.type != MESSAGE_READY)
+        {
+            fprintf(stderr, "worker %d did not start\n", i);
+            close(fds[0]);
+            waitpid(pid, nullptr, 0);
+            stop();
+            return -1;
+        }
+
+        this->workers.push_back({pid, fds[0], ncnn::get_current_time() - start});
+    }
+
+    return 0;
+}
+
+void PreforkServer::serve(int fd)
+{
+    // OpenMP thread pools do not survive fork, keep the worker's parallel regions on its own thread,
+    // the extractors would otherwise ask for the detector's thread count and wait on threads that are gone
+    ncnn::set_omp_num_threads(1);
+
+    ThreadOptions threading = this->detector.threading_options();
+    threading.num_threads = 1;
+    if (this->detector.set_threading(threading))
+        _exit(1);
+
+    MessageHeader msg = {MESSAGE_READY, 0, 0, 0};
+    if (send_all(fd, &msg, sizeof(msg)))
+        _exit(1);
+
+    cv::Mat frame;
+    std::vector<Object> objects;
+
+    while (recv_all(fd, &msg, sizeof(msg)) == 0 && msg.type != MESSAGE_EXIT)
+    {
+        if (msg.type == MESSAGE_FRAME)
+        {
+            if (frame.cols != msg.w || frame.rows != msg.h)
+                frame.create(msg.h, msg.w, CV_8UC3);
+
+            if (recv_all(fd, frame.data, frame.total()))
+                break;
+
+            objects.clear();
+            msg.status = this->detector.detect(frame, objects);
+            msg.w = objects.size();
+
+            if (send_all(fd, &msg, sizeof(msg)) || (!objects.empty() && send_all(fd, objects.data(), objects.size() * sizeof(Object))))
+                break;
+        }
+        else if (msg.type == MESSAGE_MEMORY)
+        {
+            SmapsUsage usage = SmapsUsage::current();
+            if (send_all(fd, &msg, sizeof(msg)) || send_all(fd, &usage, sizeof(usage)))
+                break;
+        }
+    }
+
+    close(fd);
+    _exit(0);
+}
+
+void PreforkServer::stop()
+{
+    for (const Worker& w : this->workers)
+    {
+        MessageHeader msg = {MESSAGE_EXIT, 0, 0, 0};
+        send_all(w.fd, &msg, sizeof(msg));
+        close(w.fd);
+    }
+
+    for (const Worker& w : this->workers)
+    {
+        waitpid(w.pid, nullptr, 0);
+    }
+
+    this->workers.clear();
+}
+
+int PreforkServer::num_workers() const
+{
+    return (int)this->workers.size();
+}
+
+int PreforkServer::submit(int worker, const cv::Mat& bgr)
+{
+    if (worker < 0 || worker >= num_workers())
+        return -1;
+
+    MessageHeader msg = {MESSAGE_FRAME, 0, bgr.cols, bgr.rows};
+    const int fd = this->workers[worker].fd;
+
+    return send_all(fd, &msg, sizeof(msg)) || send_all(fd, bgr.data, bgr.total()) ? -1 : 0;
+}
+
+int PreforkServer::receive(int worker, std::vector<Object>& objects)
+{
+    if (worker < 0 || worker >= num_workers())
+        return -1;
+
+    MessageHeader msg;
+    const int fd = this->workers[worker].fd;
+
+    if (recv_all(fd, &msg, sizeof(msg)) || msg.type != MESSAGE_FRAME)
+        return -1;
+
+    objects.resize(msg.w);
+    if (!objects.empty() && recv_all(fd, objects.data(), objects.size() * sizeof(Object)))
+        return -1;
+
+    return msg.status;
+}
+
+int PreforkServer::detect(int worker, const cv::Mat& bgr, std::vector<Object>& objects)
+{
+    if (submit(worker, bgr))
+        return -1;
+
+    return receive(worker, objects);
+}
+
+int PreforkServer::memory_usage(int worker, SmapsUsage& usage)
+{
+    if (worker < 0 || worker >= num_workers())
+        return -1;
+
+    MessageHeader msg = {MESSAGE_MEMORY, 0, 0, 0};
+    const int fd = this->workers[worker].fd;
+
+    if (send_all(fd, &msg, sizeof(msg)) || recv_all(fd, &msg, sizeof(msg)) || msg.type != MESSAGE_MEMORY)
+        return -1;
+
+    return recv_all(fd, &usage, sizeof(usage));
+}
+
+double PreforkServer::spawn_latency(int worker) const
+{
+    return this->workers[worker].spawn_latency;
+}
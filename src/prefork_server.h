@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_PREFORK_SERVER_H
+#define NCNN_YOLO_PREFORK_SERVER_H
+
+#include "YoloV7.h"
+
+#include <sys/types.h>
+
+#include <vector>
+
+namespace Yolo {
+
+    /// Memory of a process summed over /proc/self/smaps, all values in kB
+    struct SmapsUsage {
+        long rss = 0;
+        long pss = 0;
+        long shared_clean = 0;
+        long shared_dirty = 0;
+        long private_clean = 0;
+        long private_dirty = 0;
+
+        /// @brief Reads the usage of the calling process
+        static SmapsUsage current();
+    };
+
+    /// @brief Serves detections from worker processes forked off one loaded and warmed up detector
+    ///
+    /// The workers inherit the network, its packed weights and the warmed up allocations
+    /// copy-on-write, so every page they never write stays shared with the parent and the
+    /// other workers. Each worker reads frames from its own socket in submission order.
+    ///
+    /// The OpenMP thread pool of the parent is not carried over by fork, so a worker runs its
+    /// inferences on a single thread whatever `YoloV7::set_threading` asked for. Power saving policy
+    /// and affinity still apply to it. The warmup in the parent uses the detector's thread count,
+    /// scale with the number of workers instead of the threads per inference.
+    class PreforkServer {
+    public:
+        /// @brief Constructor
+        /// @param detector Initialized detector, must outlive the server
+        explicit PreforkServer(YoloV7 &detector);
+
+        /// @brief Stops all workers
+        ~PreforkServer();
+
+        /// @brief Runs a warmup inference in the parent and forks the workers
+        /// @param num_workers Number of worker processes
+        /// @param warmup_w Width of the warmup frame
+        /// @param warmup_h Height of the warmup frame
+        /// @return `0` on success, `-1` if the detector is not initialized or a worker could not be started
+        int start(int num_workers, int warmup_w = 640, int warmup_h = 640);
+
+        /// @brief Asks all workers to exit and waits for them
+        void stop();
+
+        /// @brief Number of running workers
+        int num_workers() const;
+
+        /// @brief Queues a frame on a worker, blocks only while the worker's socket buffer is full
+        /// @param worker Worker index
+        /// @param bgr Input image in BGR format
+        /// @return `0` on success, `-1` if the worker is gone
+        int submit(int worker, const cv::Mat &bgr);
+
+        /// @brief Waits for the detections of the oldest frame submitted to a worker
+        /// @param worker Worker index
+        /// @param objects Vector of predicted object detections
+        /// @return `0` on success, `-1` if the worker is gone or its detection failed
+        int receive(int worker, std::vector<Object> &objects);
+
+        /// @brief Submits a frame and waits for its detections
+        int detect(int worker, const cv::Mat &bgr, std::vector<Object> &objects);
+
+        /// @brief Memory usage of a worker, must not be called while frames are pending on it
+        /// @param worker Worker index
+        /// @param usage Usage read from the worker's /proc/self/smaps
+        /// @return `0` on success, `-1` if the worker is gone
+        int memory_usage(int worker, SmapsUsage &usage);
+
+        /// @brief Time from fork to the worker reporting ready in ms
+        double spawn_latency(int worker) const;
+
+    private:
+        PreforkServer(const PreforkServer&);
+        PreforkServer& operator=(const PreforkServer&);
+
+        struct Worker {
+            pid_t pid;
+            int fd;
+            double spawn_latency;
+        };
+
+        void serve(int fd);
+
+        YoloV7 &detector;
+        std::vector<Worker> workers;
+    };
+}
+
+#endif //NCNN_YOLO_PREFORK_SERVER_H
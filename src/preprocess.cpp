@@ -0,0 +1,479 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "preprocess.h"
+
+#include <cpu.h>
+#if __riscv_vector
+#include <riscv_vector.h>
+#endif
+#if __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+using namespace Yolo;
+
+Letterbox Yolo::make_letterbox(int img_w, int img_h, int target_size, int max_stride)
+{
+    Letterbox lb;
+    lb.img_w = img_w;
+    lb.img_h = img_h;
+
+    int w = img_w;
+    int h = img_h;
+    float scale;
+    if (w > h)
+    {
+        scale = (float)target_size / w;
+        w = target_size;
+        h = h * scale;
+    }
+    else
+    {
+        scale = (float)target_size / h;
+        h = target_size;
+        w = w * scale;
+    }
+
+    lb.w = w;
+    lb.h = h;
+    lb.scale = scale;
+    lb.wpad = (w + max_stride - 1) / max_stride * max_stride - w;
+    lb.hpad = (h + max_stride - 1) / max_stride * max_stride - h;
+
+    return lb;
+}
+
+bool Yolo::pad_letterbox(Letterbox& lb, int in_w, int in_h)
+{
+    if (lb.w > in_w || lb.h > in_h)
+        return false;
+
+    lb.wpad = in_w - lb.w;
+    lb.hpad = in_h - lb.h;
+
+    return true;
+}
+
+/// Source index and weight of the right or lower neighbour for every output coordinate, half-pixel centers as in ncnn
+static void bilinear_coeffs(int src_size, int dst_size, std::vector<int>& ofs, std::vector<float>& alpha)
+{
+    ofs.resize(dst_size);
+    alpha.resize(dst_size);
+
+    const float scale = (float)src_size / dst_size;
+    for (int d = 0; d < dst_size; d++)
+    {
+        float f = (d + 0.5f) * scale - 0.5f;
+        int s = (int)floorf(f);
+        f -= s;
+
+        if (s < 0)
+        {
+            s = 0;
+            f = 0.f;
+        }
+        if (s >= src_size - 1)
+        {
+            s = std::max(src_size - 2, 0);
+            f = src_size > 1 ? 1.f : 0.f;
+        }
+
+        ofs[d] = s;
+        alpha[d] = f;
+    }
+}
+
+static void bgr2rgb_scalar(const unsigned char* bgr, int n, float* r, float* g, float* b, float norm)
+{
+    for (int i = 0; i < n; i++)
+    {
+        b[i] = bgr[0] * norm;
+        g[i] = bgr[1] * norm;
+        r[i] = bgr[2] * norm;
+        bgr += 3;
+    }
+}
+
+static void blend_scalar(const float* row0, const float* row1, float w0, float w1, float* out, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = row0[i] * w0 + row1[i] * w1;
+    }
+}
+
+static void fill_scalar(float* out, int n, float value)
+{
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = value;
+    }
+}
+
+#if __riscv_vector
+// RVV 0.7.1 on the C906 with the XuanTie toolchain, vector length agnostic
+static void bgr2rgb_rvv(const unsigned char* bgr, int n, float* r, float* g, float* b, float norm)
+{
+    while (n > 0)
+    {
+        size_t vl = vsetvl_e8m1(n);
+
+        vuint8m1_t _b = vlse8_v_u8m1(bgr, 3, vl);
+        vuint8m1_t _g = vlse8_v_u8m1(bgr + 1, 3, vl);
+        vuint8m1_t _r = vlse8_v_u8m1(bgr + 2, 3, vl);
+
+        // u8 -> u16 -> f32
+        vfloat32m4_t _bf = vfwcvt_f_xu_v_f32m4(vwaddu_vx_u16m2(_b, 0, vl), vl);
+        vfloat32m4_t _gf = vfwcvt_f_xu_v_f32m4(vwaddu_vx_u16m2(_g, 0, vl), vl);
+        vfloat32m4_t _rf = vfwcvt_f_xu_v_f32m4(vwaddu_vx_u16m2(_r, 0, vl), vl);
+
+        vse32_v_f32m4(b, vfmul_vf_f32m4(_bf, norm, vl), vl);
+        vse32_v_f32m4(g, vfmul_vf_f32m4(_gf, norm, vl), vl);
+        vse32_v_f32m4(r, vfmul_vf_f32m4(_rf, norm, vl), vl);
+
+        bgr += vl * 3;
+        r += vl;
+        g += vl;
+        b += vl;
+        n -= vl;
+    }
+}
+
+static void blend_rvv(const float* row0, const float* row1, float w0, float w1, float* out, int n)
+{
+    while (n > 0)
+    {
+        size_t vl = vsetvl_e32m8(n);
+
+        vfloat32m8_t _p = vfmul_vf_f32m8(vle32_v_f32m8(row0, vl), w0, vl);
+        _p = vfmacc_vf_f32m8(_p, w1, vle32_v_f32m8(row1, vl), vl);
+        vse32_v_f32m8(out, _p, vl);
+
+        row0 += vl;
+        row1 += vl;
+        out += vl;
+        n -= vl;
+    }
+}
+
+static void fill_rvv(float* out, int n, float value)
+{
+    while (n > 0)
+    {
+        size_t vl = vsetvl_e32m8(n);
+
+        vse32_v_f32m8(out, vfmv_v_f_f32m8(value, vl), vl);
+
+        out += vl;
+        n -= vl;
+    }
+}
+
+static const PreprocessKernels rvv_kernels = {"rvv", bgr2rgb_rvv, blend_rvv, fill_rvv};
+#endif // __riscv_vector
+
+#if __ARM_NEON
+// AArch32 NEON on the Pi Zero 2, 8 pixels or 4 floats per step with a scalar tail
+static void bgr2rgb_neon(const unsigned char* bgr, int n, float* r, float* g, float* b, float norm)
+{
+    int i = 0;
+    for (; i + 7 < n; i += 8)
+    {
+        uint8x8x3_t _bgr = vld3_u8(bgr);
+
+        uint16x8_t _b = vmovl_u8(_bgr.val[0]);
+        uint16x8_t _g = vmovl_u8(_bgr.val[1]);
+        uint16x8_t _r = vmovl_u8(_bgr.val[2]);
+
+        vst1q_f32(b, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(_b))), norm));
+        vst1q_f32(b + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(_b))), norm));
+        vst1q_f32(g, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(_g))), norm));
+        vst1q_f32(g + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(_g))), norm));
+        vst1q_f32(r, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(_r))), norm));
+        vst1q_f32(r + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(_r))), norm));
+
+        bgr += 24;
+        r += 8;
+        g += 8;
+        b += 8;
+    }
+
+    bgr2rgb_scalar(bgr, n - i, r, g, b, norm);
+}
+
+static void blend_neon(const float* row0, const float* row1, float w0, float w1, float* out, int n)
+{
+    int i = 0;
+    for (; i + 3 < n; i += 4)
+    {
+        float32x4_t _p = vmulq_n_f32(vld1q_f32(row0 + i), w0);
+        _p = vmlaq_n_f32(_p, vld1q_f32(row1 + i), w1);
+        vst1q_f32(out + i, _p);
+    }
+
+    blend_scalar(row0 + i, row1 + i, w0, w1, out + i, n - i);
+}
+
+static void fill_neon(float* out, int n, float value)
+{
+    float32x4_t _v = vdupq_n_f32(value);
+
+    int i = 0;
+    for (; i + 3 < n; i += 4)
+    {
+        vst1q_f32(out + i, _v);
+    }
+
+    fill_scalar(out + i, n - i, value);
+}
+
+static const PreprocessKernels neon_kernels = {"neon", bgr2rgb_neon, blend_neon, fill_neon};
+#endif // __ARM_NEON
+
+static const PreprocessKernels scalar_kernels = {"scalar", bgr2rgb_scalar, blend_scalar, fill_scalar};
+
+static const PreprocessKernels* select_kernels()
+{
+#if __riscv_vector
+    if (ncnn::cpu_support_riscv_v())
+        return &rvv_kernels;
+#endif
+#if __ARM_NEON
+    if (ncnn::cpu_support_arm_neon())
+        return &neon_kernels;
+#endif
+    return &scalar_kernels;
+}
+
+const PreprocessKernels& Yolo::preprocess_kernels()
+{
+    static const PreprocessKernels* kernels = select_kernels();
+    return *kernels;
+}
+
+const PreprocessKernels& Yolo::scalar_preprocess_kernels()
+{
+    return scalar_kernels;
+}
+
+/// Horizontal bilinear resize of one row with `channels` interleaved channels into planar rows
+static void resize_row_planar(const unsigned char* src, int channels, int x1_step, const std::vector<int>& xofs,
+                              const std::vector<float>& xalpha, int w, float* out)
+{
+    for (int q = 0; q < channels; q++)
+    {
+        float* o = out + q * w;
+        for (int dx = 0; dx < w; dx++)
+        {
+            const unsigned char* p = src + xofs[dx] * channels + q;
+            const float wx1 = xalpha[dx];
+
+            o[dx] = p[0] * (1.f - wx1) + p[x1_step] * wx1;
+        }
+    }
+}
+
+/// Horizontally resized upper and lower source row of a plane, kept while consecutive output rows share them
+struct RowPair {
+    const unsigned char* plane;
+    int stride;
+    int rows;
+    int channels;
+    int x1_step;
+    int w;
+    std::vector<int> xofs;
+    std::vector<float> xalpha;
+    std::vector<float> buffer;
+    float* row0;
+    float* row1;
+    int prev_sy = -2;
+
+    RowPair(const unsigned char* plane, int stride, int src_w, int src_h, int channels, int w)
+        : plane(plane), stride(stride), rows(src_h), channels(channels), x1_step(src_w > 1 ? channels : 0), w(w),
+          buffer(w * channels * 2)
+    {
+        bilinear_coeffs(src_w, w, xofs, xalpha);
+        row0 = buffer.data();
+        row1 = row0 + w * channels;
+    }
+
+    void update(int sy)
+    {
+        const int sy1 = std::min(sy + 1, rows - 1);
+        if (sy == prev_sy + 1)
+        {
+            std::swap(row0, row1);
+            resize_row_planar(plane + sy1 * stride, channels, x1_step, xofs, xalpha, w, row1);
+        }
+        else if (sy != prev_sy)
+        {
+            resize_row_planar(plane + sy * stride, channels, x1_step, xofs, xalpha, w, row0);
+            resize_row_planar(plane + sy1 * stride, channels, x1_step, xofs, xalpha, w, row1);
+        }
+        prev_sy = sy;
+    }
+};
+
+void Yolo::letterbox_bgr2rgb(const unsigned char* bgr, int stride, const Letterbox& lb, ncnn::Mat& in, float border, float norm,
+                             const PreprocessKernels* kernels)
+{
+    const PreprocessKernels& k = kernels ? *kernels : preprocess_kernels();
+
+    const int in_w = lb.in_w();
+    const int in_h = lb.in_h();
+    const int left = lb.left();
+    const int top = lb.top();
+    const int right = in_w - left - lb.w;
+
+    if (in.w != in_w || in.h != in_h || in.c != 3 || in.elemsize != 4u)
+        in.create(in_w, in_h, 3);
+
+    const bool resize = lb.w != lb.img_w || lb.h != lb.img_h;
+
+    std::vector<int> yofs;
+    std::vector<float> yalpha;
+    std::unique_ptr<RowPair> rows;
+    if (resize)
+    {
+        bilinear_coeffs(lb.img_h, lb.h, yofs, yalpha);
+        rows.reset(new RowPair(bgr, stride, lb.img_w, lb.img_h, 3, lb.w));
+    }
+
+    const float border_value = border * norm;
+
+    float* out[3] = {in.channel(0), in.channel(1), in.channel(2)};
+
+    for (int y = 0; y < in_h; y++)
+    {
+        const int dy = y - top;
+        if (dy < 0 || dy >= lb.h)
+        {
+            for (int q = 0; q < 3; q++)
+                k.fill(out[q] + y * in_w, in_w, border_value);
+            continue;
+        }
+
+        float* r = out[0] + y * in_w;
+        float* g = out[1] + y * in_w;
+        float* b = out[2] + y * in_w;
+
+        k.fill(r, left, border_value);
+        k.fill(g, left, border_value);
+        k.fill(b, left, border_value);
+
+        if (!resize)
+        {
+            k.bgr2rgb(bgr + dy * stride, lb.w, r + left, g + left, b + left, norm);
+        }
+        else
+        {
+            rows->update(yofs[dy]);
+
+            // the vertical weights carry the normalization
+            const float wy1 = yalpha[dy] * norm;
+            const float wy0 = norm - wy1;
+
+            // BGR to RGB by blending the planar rows in reverse order
+            k.blend(rows->row0 + lb.w * 2, rows->row1 + lb.w * 2, wy0, wy1, r + left, lb.w);
+            k.blend(rows->row0 + lb.w, rows->row1 + lb.w, wy0, wy1, g + left, lb.w);
+            k.blend(rows->row0, rows->row1, wy0, wy1, b + left, lb.w);
+        }
+
+        k.fill(r + left + lb.w, right, border_value);
+        k.fill(g + left + lb.w, right, border_value);
+        k.fill(b + left + lb.w, right, border_value);
+    }
+}
+
+void Yolo::letterbox_yuv420sp2rgb(const unsigned char* yuv, const Letterbox& lb, ncnn::Mat& in, bool nv21, float border, float norm,
+                                  const PreprocessKernels* kernels)
+{
+    const PreprocessKernels& k = kernels ? *kernels : preprocess_kernels();
+
+    const int in_w = lb.in_w();
+    const int in_h = lb.in_h();
+    const int left = lb.left();
+    const int top = lb.top();
+    const int right = in_w - left - lb.w;
+
+    if (in.w != in_w || in.h != in_h || in.c != 3 || in.elemsize != 4u)
+        in.create(in_w, in_h, 3);
+
+    // chroma is sampled at half resolution, its output coordinates map onto the half size plane
+    RowPair luma(yuv, lb.img_w, lb.img_w, lb.img_h, 1, lb.w);
+    RowPair chroma(yuv + lb.img_w * lb.img_h, lb.img_w, lb.img_w / 2, lb.img_h / 2, 2, lb.w);
+
+    std::vector<int> yofs, cofs;
+    std::vector<float> yalpha, calpha;
+    bilinear_coeffs(lb.img_h, lb.h, yofs, yalpha);
+    bilinear_coeffs(lb.img_h / 2, lb.h, cofs, calpha);
+
+    std::vector<float> yuv_row(lb.w * 3);
+    float* y_row = yuv_row.data();
+    float* u_row = y_row + lb.w;
+    float* v_row = u_row + lb.w;
+    if (nv21)
+        std::swap(u_row, v_row);
+
+    const float border_value = border * norm;
+
+    float* out[3] = {in.channel(0), in.channel(1), in.channel(2)};
+
+    for (int y = 0; y < in_h; y++)
+    {
+        const int dy = y - top;
+        if (dy < 0 || dy >= lb.h)
+        {
+            for (int q = 0; q < 3; q++)
+                k.fill(out[q] + y * in_w, in_w, border_value);
+            continue;
+        }
+
+        float* r = out[0] + y * in_w;
+        float* g = out[1] + y * in_w;
+        float* b = out[2] + y * in_w;
+
+        k.fill(r, left, border_value);
+        k.fill(g, left, border_value);
+        k.fill(b, left, border_value);
+
+        luma.update(yofs[dy]);
+        chroma.update(cofs[dy]);
+
+        k.blend(luma.row0, luma.row1, 1.f - yalpha[dy], yalpha[dy], y_row, lb.w);
+        k.blend(chroma.row0, chroma.row1, 1.f - calpha[dy], calpha[dy], yuv_row.data() + lb.w, lb.w * 2);
+
+        // conversion is linear, so interpolating YUV first equals interpolating RGB up to the clamping
+        for (int dx = 0; dx < lb.w; dx++)
+        {
+            const float yy = (y_row[dx] - 16.f) * 1.164f;
+            const float u = u_row[dx] - 128.f;
+            const float v = v_row[dx] - 128.f;
+
+            r[left + dx] = std::min(std::max(yy + 1.596f * v, 0.f), 255.f) * norm;
+            g[left + dx] = std::min(std::max(yy - 0.813f * v - 0.391f * u, 0.f), 255.f) * norm;
+            b[left + dx] = std::min(std::max(yy + 2.018f * u, 0.f), 255.f) * norm;
+        }
+
+        k.fill(r + left + lb.w, right, border_value);
+        k.fill(g + left + lb.w, right, border_value);
+        k.fill(b + left + lb.w, right, border_value);
+    }
+}
+
+void Yolo::letterbox_bgr2rgb_ncnn(const unsigned char* bgr, int stride, const Letterbox& lb, ncnn::Mat& in, float border, float norm)
+{
+    ncnn::Mat resized = ncnn::Mat::from_pixels_resize(bgr, ncnn::Mat::PIXEL_BGR2RGB, lb.img_w, lb.img_h, stride, lb.w, lb.h);
+
+    ncnn::copy_make_border(resized, in, lb.top(), lb.hpad - lb.top(), lb.left(), lb.wpad - lb.left(), ncnn::BORDER_CONSTANT, border);
+
+    const float norm_vals[3] = {norm, norm, norm};
+    in.substract_mean_normalize(nullptr, norm_vals);
+}
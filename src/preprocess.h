@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_PREPROCESS_H
+#define NCNN_YOLO_PREPROCESS_H
+
+#include "mat.h"
+
+namespace Yolo {
+
+    /// Geometry of an image letterboxed into the network input
+    struct Letterbox {
+        int img_w;      // source image
+        int img_h;
+        int w;          // resized image inside the input
+        int h;
+        int wpad;       // total horizontal and vertical padding
+        int hpad;
+        float scale;    // resized / source
+
+        int in_w() const { return w + wpad; }
+        int in_h() const { return h + hpad; }
+        int left() const { return wpad / 2; }
+        int top() const { return hpad / 2; }
+    };
+
+    /// Row kernels of the letterbox, vectorized with RVV or NEON where the build and the CPU support it
+    struct PreprocessKernels {
+        const char* name;
+
+        /// Interleaved BGR bytes to scaled planar R, G and B floats
+        void (*bgr2rgb)(const unsigned char* bgr, int n, float* r, float* g, float* b, float norm);
+        /// Weighted sum of two rows, the vertical step of the bilinear resize, weights include the scaling
+        void (*blend)(const float* row0, const float* row1, float w0, float w1, float* out, int n);
+        /// Constant fill of the letterbox border
+        void (*fill)(float* out, int n, float value);
+    };
+
+    /// @brief Fastest kernels for this CPU, selected once at runtime
+    const PreprocessKernels& preprocess_kernels();
+
+    /// @brief Portable scalar kernels, the fallback if no vector extension is available
+    const PreprocessKernels& scalar_preprocess_kernels();
+
+    /// @brief Scales the long side of an image to the target size and pads both sides to a multiple of the stride
+    /// @param img_w Width of the source image
+    /// @param img_h Height of the source image
+    /// @param target_size Long side of the resized image
+    /// @param max_stride Input width and height are padded to a multiple of it
+    Letterbox make_letterbox(int img_w, int img_h, int target_size, int max_stride);
+
+    /// @brief Pads a letterbox to a fixed input shape instead of the next multiple of the stride
+    /// @param lb Letterbox geometry from `make_letterbox`, its padding is replaced
+    /// @param in_w Input width
+    /// @param in_h Input height
+    /// @return `false` and `lb` unchanged if the resized image does not fit into the shape
+    bool pad_letterbox(Letterbox &lb,
+                       int in_w,
+                       int in_h);
+
+    /// @brief Letterboxes a BGR image into a planar RGB network input in a single pass
+    ///
+    /// Channel swap, bilinear resize, constant border and scaling are fused, every input
+    /// element is written exactly once and the border is filled without being resized.
+    /// Source rows are resized horizontally once into row buffers and blended vertically,
+    /// an image that already has the target size is only converted.
+    /// @param bgr Interleaved BGR pixels
+    /// @param stride Bytes per source row
+    /// @param lb Letterbox geometry from `make_letterbox`
+    /// @param in Network input, reallocated only if its shape does not match `lb`
+    /// @param border Border value before scaling, YOLOv7 pads with 114
+    /// @param norm Scale applied to all values
+    /// @param kernels Row kernels, `preprocess_kernels()` if null
+    void letterbox_bgr2rgb(const unsigned char* bgr,
+                           int stride,
+                           const Letterbox &lb,
+                           ncnn::Mat &in,
+                           float border = 114.f,
+                           float norm = 1 / 255.f,
+                           const PreprocessKernels* kernels = nullptr);
+
+    /// @brief Letterboxes a YUV420sp camera frame into a planar RGB network input in a single pass
+    ///
+    /// Luma and chroma are resized separately at their own resolution and converted to RGB
+    /// (BT.601 limited range, like ncnn's yuv420sp2rgb) only for the pixels of the input,
+    /// so no full resolution RGB or BGR image is created.
+    /// @param yuv Full resolution Y plane followed by the interleaved half resolution chroma plane
+    /// @param lb Letterbox geometry from `make_letterbox`, the source width and height must be even
+    /// @param in Network input, reallocated only if its shape does not match `lb`
+    /// @param nv21 `false` for NV12 (U before V), `true` for NV21 (V before U)
+    /// @param border Border value before scaling, YOLOv7 pads with 114
+    /// @param norm Scale applied to all values
+    /// @param kernels Row kernels, `preprocess_kernels()` if null
+    void letterbox_yuv420sp2rgb(const unsigned char* yuv,
+                                const Letterbox &lb,
+                                ncnn::Mat &in,
+                                bool nv21 = false,
+                                float border = 114.f,
+                                float norm = 1 / 255.f,
+                                const PreprocessKernels* kernels = nullptr);
+
+    /// @brief Reference letterbox with ncnn's pixel functions, resize, copy_make_border and substract_mean_normalize
+    void letterbox_bgr2rgb_ncnn(const unsigned char* bgr,
+                                int stride,
+                                const Letterbox &lb,
+                                ncnn::Mat &in,
+                                float border = 114.f,
+                                float norm = 1 / 255.f);
+}
+
+#endif //NCNN_YOLO_PREPROCESS_H
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "proposals.h"
+
+#include <algorithm>
+
+using namespace Yolo;
+
+static bool more_probable(const Object& a, const Object& b)
+{
+    return a.prob > b.prob;
+}
+
+void Yolo::sort_top_proposals(std::vector<Object>& objects, int max_candidates)
+{
+    if (max_candidates > 0 && (int)objects.size() > max_candidates)
+    {
+        std::nth_element(objects.begin(), objects.begin() + max_candidates, objects.end(), more_probable);
+        objects.resize(max_candidates);
+    }
+
+    std::sort(objects.begin(), objects.end(), more_probable);
+}
+
+static void qsort_descent_inplace(std::vector<Object>& objects, int left, int right)
+{
+    int i = left;
+    int j = right;
+    float p = objects[(left + right) / 2].prob;
+
+    while (i <= j)
+    {
+        while (objects[i].prob > p)
+            i++;
+
+        while (objects[j].prob < p)
+            j--;
+
+        if (i <= j)
+        {
+            // swap
+            std::swap(objects[i], objects[j]);
+
+            i++;
+            j--;
+        }
+    }
+
+#pragma omp parallel sections
+    {
+#pragma omp section
+        {
+            if (left < j) qsort_descent_inplace(objects, left, j);
+        }
+#pragma omp section
+        {
+            if (i < right) qsort_descent_inplace(objects, i, right);
+        }
+    }
+}
+
+void Yolo::qsort_descent_inplace(std::vector<Object>& objects)
+{
+    if (objects.empty())
+        return;
+
+    ::qsort_descent_inplace(objects, 0, objects.size() - 1);
+}
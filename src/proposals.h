@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_PROPOSALS_H
+#define NCNN_YOLO_PROPOSALS_H
+
+#include "YoloV7.h"
+
+#include <vector>
+
+namespace Yolo {
+
+    /// @brief Keeps the `max_candidates` most probable proposals and sorts them from highest to lowest
+    ///
+    /// The cut is a partial selection with `std::nth_element` in linear time, only the retained
+    /// proposals are sorted, on the calling thread.
+    /// @param objects Proposals, reduced to at most `max_candidates` in descending probability
+    /// @param max_candidates Number of proposals kept, `0` keeps all
+    void sort_top_proposals(std::vector<Object> &objects,
+                            int max_candidates);
+
+    /// @brief Reference sort of all proposals in descending probability, a quicksort that opens
+    /// OpenMP sections for both partitions at every level of the recursion
+    void qsort_descent_inplace(std::vector<Object> &objects);
+}
+
+#endif //NCNN_YOLO_PROPOSALS_H
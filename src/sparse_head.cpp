@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "sparse_head.h"
+#include "decoder.h"
+
+#include <cpu.h>
+
+#include <cstdio>
+
+using namespace Yolo;
+
+/// Forwards to another ModelBin and keeps a reference to every blob it loads
+class RecordingModelBin : public ncnn::ModelBin {
+public:
+    explicit RecordingModelBin(const ncnn::ModelBin& mb) : mb(mb)
+    {
+    }
+
+    ncnn::Mat load(int w, int type) const override
+    {
+        ncnn::Mat m = mb.load(w, type);
+        loaded.push_back(m);
+        return m;
+    }
+
+    const ncnn::ModelBin& mb;
+    mutable std::vector<ncnn::Mat> loaded;
+};
+
+static ncnn::Layer* create_sparse_head(void* userdata)
+{
+    SparseHeadConvolution* layer = new SparseHeadConvolution;
+    static_cast<std::vector<SparseHeadConvolution*>*>(userdata)->push_back(layer);
+    return layer;
+}
+
+static void destroy_sparse_head(ncnn::Layer* layer, void* userdata)
+{
+    std::vector<SparseHeadConvolution*>& layers = *static_cast<std::vector<SparseHeadConvolution*>*>(userdata);
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        if (layers[i] == layer)
+        {
+            layers.erase(layers.begin() + i);
+            break;
+        }
+    }
+
+    delete layer;
+}
+
+SparseHeadConvolution::SparseHeadConvolution()
+    : conv(ncnn::create_layer_cpu("Convolution")), num_output(0), kernel_w(0), kernel_h(0), dilation_w(1), dilation_h(1),
+      stride_w(1), stride_h(1), pad(0), bias_term(0), weight_data_size(0), int8_scale_term(0), activation_type(0),
+      sparse(false), num_anchors(0), num_classes(0), box_threshold(0),
+      frames(0), cells(0), candidates(0), dense_macs(0), sparse_macs(0)
+{
+    copy_flags();
+}
+
+SparseHeadConvolution::~SparseHeadConvolution()
+{
+    delete this->conv;
+}
+
+int SparseHeadConvolution::register_on(ncnn::Net& net, std::vector<SparseHeadConvolution*>& layers)
+{
+    return net.register_custom_layer("Convolution", create_sparse_head, destroy_sparse_head, &layers);
+}
+
+/// Takes over the storage and layout flags of ncnn's convolution, which the extractor converts the blobs for
+void SparseHeadConvolution::copy_flags()
+{
+    this->one_blob_only = this->conv->one_blob_only;
+    this->support_inplace = this->conv->support_inplace;
+    this->support_packing = this->conv->support_packing;
+    this->support_bf16_storage = this->conv->support_bf16_storage;
+    this->support_fp16_storage = this->conv->support_fp16_storage;
+    this->support_int8_storage = this->conv->support_int8_storage;
+}
+
+int SparseHeadConvolution::load_param(const ncnn::ParamDict& pd)
+{
+    this->num_output = pd.get(0, 0);
+    this->kernel_w = pd.get(1, 0);
+    this->kernel_h = pd.get(11, this->kernel_w);
+    this->dilation_w = pd.get(2, 1);
+    this->dilation_h = pd.get(12, this->dilation_w);
+    this->stride_w = pd.get(3, 1);
+    this->stride_h = pd.get(13, this->stride_w);
+    this->pad = pd.get(4, 0) | pd.get(14, pd.get(4, 0));
+    this->bias_term = pd.get(5, 0);
+    this->weight_data_size = pd.get(6, 0);
+    this->int8_scale_term = pd.get(8, 0);
+    this->activation_type = pd.get(9, 0);
+
+    // ncnn's convolution sees the same layer as this one
+    this->conv->type = this->type;
+    this->conv->name = this->name;
+    this->conv->typeindex = this->typeindex;
+    this->conv->bottoms = this->bottoms;
+    this->conv->tops = this->tops;
+    this->conv->bottom_shapes = this->bottom_shapes;
+    this->conv->top_shapes = this->top_shapes;
+    this->conv->featmask = this->featmask;
+
+    int ret = this->conv->load_param(pd);
+    copy_flags();
+
+    return ret;
+}
+
+int SparseHeadConvolution::load_model(const ncnn::ModelBin& mb)
+{
+    RecordingModelBin recording_mb(mb);
+    int ret = this->conv->load_model(recording_mb);
+    copy_flags();
+
+    // weights first, then the bias, the same blobs ncnn's convolution holds
+    if (ret == 0 && recording_mb.loaded.size() >= 2)
+    {
+        this->weight_data = recording_mb.loaded[0];
+        this->bias_data = recording_mb.loaded[1];
+    }
+
+    return ret;
+}
+
+int SparseHeadConvolution::create_pipeline(const ncnn::Option& opt)
+{
+    int ret = this->conv->create_pipeline(opt);
+    if (!this->sparse)
+        copy_flags();
+
+    return ret;
+}
+
+int SparseHeadConvolution::destroy_pipeline(const ncnn::Option& opt)
+{
+    return this->conv->destroy_pipeline(opt);
+}
+
+bool SparseHeadConvolution::is_head(int num_anchors, int num_classes) const
+{
+    const int num_input = this->num_output > 0 ? this->weight_data_size / this->num_output : 0;
+
+    return this->num_output == num_anchors * (5 + num_classes) && this->kernel_w == 1 && this->kernel_h == 1 &&
+           this->dilation_w == 1 && this->dilation_h == 1 && this->stride_w == 1 && this->stride_h == 1 &&
+           this->pad == 0 && this->bias_term && this->int8_scale_term == 0 && this->activation_type == 0 &&
+           this->weight_data.elemsize == 4 && (int)this->weight_data.total() == this->num_output * num_input &&
+           (int)this->bias_data.total() == this->num_output;
+}
+
+void SparseHeadConvolution::set_sparse(int num_anchors, int num_classes, float box_threshold)
+{
+    this->sparse = true;
+    this->num_anchors = num_anchors;
+    this->num_classes = num_classes;
+    this->box_threshold = box_threshold;
+
+    // plain float planes
+    this->one_blob_only = true;
+    this->support_inplace = false;
+    this->support_packing = false;
+    this->support_bf16_storage = false;
+    this->support_fp16_storage = false;
+    this->support_int8_storage = false;
+}
+
+bool SparseHeadConvolution::is_sparse() const
+{
+    return this->sparse;
+}
+
+void SparseHeadConvolution::release_weights()
+{
+    this->weight_data.release();
+    this->bias_data.release();
+}
+
+void SparseHeadConvolution::add_stats(SparseHeadStats& stats) const
+{
+    stats.frames += this->frames;
+    stats.cells += this->cells;
+    stats.candidates += this->candidates;
+    stats.dense_macs += this->dense_macs;
+    stats.sparse_macs += this->sparse_macs;
+}
+
+int SparseHeadConvolution::forward(const ncnn::Mat& bottom_blob, ncnn::Mat& top_blob, const ncnn::Option& opt) const
+{
+    if (this->sparse)
+        return forward_sparse(bottom_blob, top_blob, opt);
+
+    return this->conv->forward(bottom_blob, top_blob, opt);
+}
+
+int SparseHeadConvolution::forward(const std::vector<ncnn::Mat>& bottom_blobs, std::vector<ncnn::Mat>& top_blobs, const ncnn::Option& opt) const
+{
+    return this->conv->forward(bottom_blobs, top_blobs, opt);
+}
+
+int SparseHeadConvolution::forward_inplace(ncnn::Mat& bottom_top_blob, const ncnn::Option& opt) const
+{
+    return this->conv->forward_inplace(bottom_top_blob, opt);
+}
+
+int SparseHeadConvolution::forward_sparse(const ncnn::Mat& bottom_blob, ncnn::Mat& top_blob, const ncnn::Option& opt) const
+{
+    const int w = bottom_blob.w;
+    const int h = bottom_blob.h;
+    const int size = w * h;
+    const int num_input = bottom_blob.c;
+    const int num_per_anchor = 5 + this->num_classes;
+
+    if (num_input * this->num_output != (int)this->weight_data.total() || bottom_blob.elempack != 1)
+    {
+        fprintf(stderr, "sparse head %s got %d input channels, expected %d\n", this->name.c_str(), num_input, (int)this->weight_data.total() / this->num_output);
+        return -1;
+    }
+
+    top_blob.create(w, h, this->num_output, 4u, opt.blob_allocator);
+    if (top_blob.empty())
+        return -100;
+
+    const float* weights = this->weight_data;
+    const float* bias = this->bias_data;
+    const float* input = bottom_blob;
+
+    // phase one, the objectness channel of every anchor for all cells
+    #pragma omp parallel for num_threads(opt.num_threads)
+    for (int q = 0; q < this->num_anchors; q++)
+    {
+        const int c = q * num_per_anchor + 4;
+        const float* kernel = weights + c * num_input;
+        float* out = top_blob.channel(c);
+
+        for (int i = 0; i < size; i++)
+            out[i] = bias[c];
+
+        for (int k = 0; k < num_input; k++)
+        {
+            const float* in = bottom_blob.channel(k);
+            const float wk = kernel[k];
+            for (int i = 0; i < size; i++)
+                out[i] += wk * in[i];
+        }
+    }
+
+    // phase two, box and class channels of the cells that passed, from a contiguous copy of their input column
+    const DecodeKernels& kernels = decode_kernels();
+    size_t num_candidates = 0;
+    std::vector<int> indexes(size);
+    std::vector<float> columns((size_t)opt.num_threads * num_input);
+    for (int q = 0; q < this->num_anchors; q++)
+    {
+        const int c0 = q * num_per_anchor;
+        const int n = kernels.compact(top_blob.channel(c0 + 4), size, this->box_threshold, indexes.data());
+        num_candidates += n;
+
+        #pragma omp parallel for num_threads(opt.num_threads)
+        for (int t = 0; t < n; t++)
+        {
+            const int i = indexes[t];
+            float* column = columns.data() + (size_t)ncnn::get_omp_thread_num() * num_input;
+            for (int k = 0; k < num_input; k++)
+                column[k] = input[k * bottom_blob.cstep + i];
+
+            for (int c = c0; c < c0 + num_per_anchor; c++)
+            {
+                if (c == c0 + 4)
+                    continue;
+
+                const float* kernel = weights + c * num_input;
+                float sum = bias[c];
+                for (int k = 0; k < num_input; k++)
+                    sum += kernel[k] * column[k];
+
+                top_blob.channel(c)[i] = sum;
+            }
+        }
+    }
+
+    this->frames++;
+    this->cells += (size_t)size * this->num_anchors;
+    this->candidates += num_candidates;
+    this->dense_macs += (size_t)size * this->num_output * num_input;
+    this->sparse_macs += ((size_t)size * this->num_anchors + num_candidates * (num_per_anchor - 1)) * num_input;
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_SPARSE_HEAD_H
+#define NCNN_YOLO_SPARSE_HEAD_H
+
+#include "layer.h"
+#include "mat.h"
+#include "modelbin.h"
+#include "net.h"
+#include "option.h"
+#include "paramdict.h"
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace Yolo {
+
+    /// Multiply-accumulates of the sparse detection heads since the model was loaded
+    struct SparseHeadStats {
+        size_t frames{};            // forward passes of all heads
+        size_t cells{};             // grid cells times anchors
+        size_t candidates{};        // of those, passed the objectness threshold
+        size_t dense_macs{};        // of a regular 1x1 convolution
+        size_t sparse_macs{};       // actually computed
+    };
+
+    /// @brief Convolution that evaluates a 1x1 detection head only where objectness passes
+    ///
+    /// Registered for the type `Convolution`, so it replaces every convolution of the network. Until
+    /// `set_sparse` is called it forwards everything to ncnn's own convolution. In sparse mode it first
+    /// computes the objectness channel of each anchor for all cells, then the box and class channels
+    /// only for the cells whose objectness logit reaches the threshold. The other box and class values
+    /// of the output are left undefined, the two-phase decoder never reads them.
+    class SparseHeadConvolution : public ncnn::Layer {
+    public:
+        SparseHeadConvolution();
+        ~SparseHeadConvolution() override;
+
+        /// @brief Registers the layer on a network, must be called before its param is loaded
+        /// @param net Network to register on
+        /// @param layers Receives every created layer, the network owns them
+        static int register_on(ncnn::Net &net,
+                               std::vector<SparseHeadConvolution*> &layers);
+
+        int load_param(const ncnn::ParamDict &pd) override;
+        int load_model(const ncnn::ModelBin &mb) override;
+        int create_pipeline(const ncnn::Option &opt) override;
+        int destroy_pipeline(const ncnn::Option &opt) override;
+
+        int forward(const ncnn::Mat &bottom_blob, ncnn::Mat &top_blob, const ncnn::Option &opt) const override;
+        int forward(const std::vector<ncnn::Mat> &bottom_blobs, std::vector<ncnn::Mat> &top_blobs, const ncnn::Option &opt) const override;
+        int forward_inplace(ncnn::Mat &bottom_top_blob, const ncnn::Option &opt) const override;
+
+        /// @brief Whether this is a float 1x1 convolution with bias and without activation that has
+        /// `num_anchors * (5 + num_classes)` outputs
+        bool is_head(int num_anchors,
+                     int num_classes) const;
+
+        /// @brief Switches to sparse evaluation, only valid for a head that produces a network output
+        /// @param num_anchors Anchors of the head
+        /// @param num_classes Classes per anchor
+        /// @param box_threshold Smallest objectness logit of a cell whose other channels are computed
+        void set_sparse(int num_anchors,
+                        int num_classes,
+                        float box_threshold);
+
+        bool is_sparse() const;
+
+        /// @brief Drops the reference to the loaded weights, which only sparse evaluation reads,
+        /// so that ncnn's convolution can free them after repacking
+        void release_weights();
+
+        /// @brief Adds the counters of this layer to `stats`
+        void add_stats(SparseHeadStats &stats) const;
+
+    private:
+        SparseHeadConvolution(const SparseHeadConvolution&);
+        SparseHeadConvolution& operator=(const SparseHeadConvolution&);
+
+        void copy_flags();
+
+        int forward_sparse(const ncnn::Mat &bottom_blob, ncnn::Mat &top_blob, const ncnn::Option &opt) const;
+
+        ncnn::Layer* conv;              // ncnn's convolution, runs everything but sparse heads
+
+        int num_output;
+        int kernel_w;
+        int kernel_h;
+        int dilation_w;
+        int dilation_h;
+        int stride_w;
+        int stride_h;
+        int pad;
+        int bias_term;
+        int weight_data_size;
+        int int8_scale_term;
+        int activation_type;
+
+        // the loaded weights, shared with ncnn's convolution until release_weights
+        ncnn::Mat weight_data;
+        ncnn::Mat bias_data;
+
+        bool sparse;
+        int num_anchors;
+        int num_classes;
+        float box_threshold;
+
+        mutable std::atomic<size_t> frames;
+        mutable std::atomic<size_t> cells;
+        mutable std::atomic<size_t> candidates;
+        mutable std::atomic<size_t> dense_macs;
+        mutable std::atomic<size_t> sparse_macs;
+    };
+}
+
+#endif //NCNN_YOLO_SPARSE_HEAD_H
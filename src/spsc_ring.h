@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_SPSC_RING_H
+#define NCNN_YOLO_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace Yolo {
+
+    /// @brief Bounded lock-free ring for exactly one producer and one consumer thread
+    ///
+    /// Head and tail only grow and are each written by one side, the slot is published
+    /// with release and taken over with acquire ordering. They sit on separate cache
+    /// lines so that producer and consumer do not invalidate each other's line.
+    template<typename T>
+    class SpscRing {
+    public:
+        /// @param capacity Number of elements, rounded up to a power of two
+        explicit SpscRing(size_t capacity)
+        {
+            size_t size = 1;
+            while (size < capacity)
+                size *= 2;
+
+            this->slots.resize(size);
+            this->mask = size - 1;
+        }
+
+        /// @brief Called by the producer only
+        /// @return `false` if the ring is full
+        bool try_push(const T& value)
+        {
+            const size_t t = this->tail.load(std::memory_order_relaxed);
+            if (t - this->head.load(std::memory_order_acquire) == this->slots.size())
+                return false;
+
+            this->slots[t & this->mask] = value;
+            this->tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Called by the consumer only
+        /// @return `false` if the ring is empty
+        bool try_pop(T& value)
+        {
+            const size_t h = this->head.load(std::memory_order_relaxed);
+            if (h == this->tail.load(std::memory_order_acquire))
+                return false;
+
+            value = this->slots[h & this->mask];
+            this->head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Number of elements, exact only when called by the producer or the consumer
+        size_t size() const
+        {
+            return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const
+        {
+            return this->slots.size();
+        }
+
+    private:
+        std::vector<T> slots;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head{0};    // next element to pop, written by the consumer
+        alignas(64) std::atomic<size_t> tail{0};    // next free slot, written by the producer
+    };
+}
+
+#endif //NCNN_YOLO_SPSC_RING_H
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "tiling.h"
+
+#include <algorithm>
+
+using namespace Yolo;
+
+/// Start offsets of the tiles along one axis
+static std::vector<int> tile_starts(int size, int tile_size, int overlap)
+{
+    std::vector<int> starts;
+    if (size <= tile_size)
+    {
+        starts.push_back(0);
+        return starts;
+    }
+
+    const int step = std::max(tile_size - overlap, 1);
+    for (int start = 0;; start += step)
+    {
+        if (start + tile_size >= size)
+        {
+            starts.push_back(size - tile_size);
+            break;
+        }
+        starts.push_back(start);
+    }
+
+    return starts;
+}
+
+std::vector<cv::Rect> Yolo::make_tiles(int img_w, int img_h, int tile_size, int overlap)
+{
+    std::vector<cv::Rect> tiles;
+
+    for (int y : tile_starts(img_h, tile_size, overlap))
+    {
+        for (int x : tile_starts(img_w, tile_size, overlap))
+        {
+            tiles.push_back(cv::Rect(x, y, std::min(tile_size, img_w), std::min(tile_size, img_h)));
+        }
+    }
+
+    return tiles;
+}
+
+namespace {
+    struct Candidate {
+        Object object;
+        int tile;
+        bool cut;       // touches a tile border inside the image
+    };
+}
+
+/// Checks whether a box ends at a tile border that is not an image border
+static bool is_cut(const cv::Rect_<float>& r, const cv::Rect& tile, int img_w, int img_h)
+{
+    const float eps = 2.f;
+
+    return (tile.x > 0 && r.x <= tile.x + eps) ||
+           (tile.y > 0 && r.y <= tile.y + eps) ||
+           (tile.x + tile.width < img_w && r.x + r.width >= tile.x + tile.width - eps) ||
+           (tile.y + tile.height < img_h && r.y + r.height >= tile.y + tile.height - eps);
+}
+
+void Yolo::merge_tiles(const std::vector<TileResult>& results, int img_w, int img_h, float nms_threshold, float seam_threshold,
+                       std::vector<Object>& objects)
+{
+    std::vector<Candidate> candidates;
+    for (size_t t = 0; t < results.size(); t++)
+    {
+        for (const Object& obj : results[t].objects)
+            candidates.push_back({obj, (int)t, is_cut(obj.rect, results[t].tile, img_w, img_h)});
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.object.prob > b.object.prob;
+    });
+
+    std::vector<Candidate> picked;
+    for (const Candidate& a : candidates)
+    {
+        const float area_a = a.object.rect.area();
+
+        bool keep = true;
+        for (Candidate& b : picked)
+        {
+            if (a.object.label != b.object.label)
+                continue;
+
+            const float area_b = b.object.rect.area();
+            const float inter_area = (a.object.rect & b.object.rect).area();
+
+            // one part of an object split by a seam, the kept box takes over the full extent
+            if (a.tile != b.tile && (a.cut || b.cut) && inter_area / std::min(area_a, area_b) > seam_threshold)
+            {
+                b.object.rect = b.object.rect | a.object.rect;
+                b.cut = b.cut && a.cut;
+                keep = false;
+                break;
+            }
+
+            if (inter_area / (area_a + area_b - inter_area) > nms_threshold)
+            {
+                keep = false;
+                break;
+            }
+        }
+
+        if (keep)
+            picked.push_back(a);
+    }
+
+    objects.clear();
+    for (const Candidate& c : picked)
+        objects.push_back(c.object);
+}
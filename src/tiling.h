@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_TILING_H
+#define NCNN_YOLO_TILING_H
+
+#include "YoloV7.h"
+
+#include <vector>
+
+namespace Yolo {
+
+    /// Detections of one tile, or of the whole downscaled frame
+    struct TileResult {
+        cv::Rect tile;                  // in image coordinates, the whole image for the full frame pass
+        std::vector<Object> objects;    // in image coordinates
+    };
+
+    /// @brief Splits an image into overlapping square tiles, the last row and column are aligned to the image border
+    /// @param img_w Image width
+    /// @param img_h Image height
+    /// @param tile_size Tile side, tiles are smaller if the image is
+    /// @param overlap Pixels shared by neighbouring tiles
+    std::vector<cv::Rect> make_tiles(int img_w,
+                                     int img_h,
+                                     int tile_size,
+                                     int overlap);
+
+    /// @brief Merges the detections of all tiles into one list, duplicates at tile seams are removed
+    ///
+    /// Boxes of the same class are suppressed by IoU as in the regular NMS. A box that is cut by
+    /// an inner tile border is also suppressed if it mostly lies inside a higher scoring box from
+    /// another tile, which is then grown to cover both, so an object split across a seam is
+    /// reported once with its full extent.
+    /// @param results Detections per tile
+    /// @param img_w Image width, borders of the image do not cut boxes
+    /// @param img_h Image height
+    /// @param nms_threshold IoU above which boxes are duplicates
+    /// @param seam_threshold Share of the cut box covered by the other box above which it is a duplicate
+    /// @param objects Merged detections sorted by score
+    void merge_tiles(const std::vector<TileResult> &results,
+                     int img_w,
+                     int img_h,
+                     float nms_threshold,
+                     float seam_threshold,
+                     std::vector<Object> &objects);
+}
+
+#endif //NCNN_YOLO_TILING_H
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include "worker_allocators.h"
+
+using namespace Yolo;
+
+CountingAllocator::CountingAllocator(ncnn::Allocator* pool) : pool(pool), num_requests(0), num_mallocs(0)
+{
+}
+
+void* CountingAllocator::fastMalloc(size_t size)
+{
+    void* ptr = this->pool->fastMalloc(size);
+
+    this->num_requests++;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->cached.erase(ptr) == 0)
+            this->num_mallocs++;
+    }
+
+    return ptr;
+}
+
+void CountingAllocator::fastFree(void* ptr)
+{
+    // recorded before the pool can hand the buffer out again
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->cached.insert(ptr);
+    }
+
+    this->pool->fastFree(ptr);
+}
+
+size_t CountingAllocator::requests() const
+{
+    return this->num_requests;
+}
+
+size_t CountingAllocator::mallocs() const
+{
+    return this->num_mallocs;
+}
+
+WorkerAllocators::WorkerAllocators(const PoolOptions& options, int slot)
+    : slot(slot), frames(0), blob(&blob_pool), workspace(&workspace_pool)
+{
+    this->blob_pool.set_size_compare_ratio(options.size_compare_ratio);
+    this->blob_pool.set_size_drop_threshold(options.size_drop_threshold);
+    this->workspace_pool.set_size_compare_ratio(options.size_compare_ratio);
+    this->workspace_pool.set_size_drop_threshold(options.size_drop_threshold);
+}
+
+ncnn::Allocator* WorkerAllocators::blob_allocator()
+{
+    return &this->blob;
+}
+
+ncnn::Allocator* WorkerAllocators::workspace_allocator()
+{
+    return &this->workspace;
+}
+
+size_t WorkerAllocators::requests() const
+{
+    return this->blob.requests() + this->workspace.requests();
+}
+
+size_t WorkerAllocators::mallocs() const
+{
+    return this->blob.mallocs() + this->workspace.mallocs();
+}
+
+WorkerAllocatorPool::WorkerAllocatorPool(const PoolOptions& options) : pool_options(options)
+{
+}
+
+WorkerAllocators* WorkerAllocatorPool::acquire(int slot)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for (size_t i = this->idle.size(); i-- > 0;)
+    {
+        if (this->idle[i]->slot == slot)
+        {
+            WorkerAllocators* allocators = this->idle[i];
+            this->idle.erase(this->idle.begin() + i);
+            return allocators;
+        }
+    }
+
+    this->workers.emplace_back(new WorkerAllocators(this->pool_options, slot));
+    return this->workers.back().get();
+}
+
+void WorkerAllocatorPool::release(WorkerAllocators* allocators)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->idle.push_back(allocators);
+}
+
+AllocatorStats WorkerAllocatorPool::stats() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    AllocatorStats stats;
+    stats.workers = this->workers.size();
+    for (const std::unique_ptr<WorkerAllocators>& allocators : this->workers)
+    {
+        stats.frames += allocators->frames;
+        stats.requests += allocators->requests();
+        stats.mallocs += allocators->mallocs();
+    }
+
+    return stats;
+}
+
+const PoolOptions& WorkerAllocatorPool::options() const
+{
+    return this->pool_options;
+}
+
+WorkerAllocatorLease::WorkerAllocatorLease(WorkerAllocatorPool* pool, int slot)
+    : allocators(pool ? pool->acquire(slot) : nullptr), pool(pool)
+{
+}
+
+WorkerAllocatorLease::~WorkerAllocatorLease()
+{
+    if (this->allocators)
+        this->pool->release(this->allocators);
+}
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#ifndef NCNN_YOLO_WORKER_ALLOCATORS_H
+#define NCNN_YOLO_WORKER_ALLOCATORS_H
+
+#include "allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace Yolo {
+
+    /// Pool allocators of the detection workers, see `YoloV7::set_pool_options`
+    struct PoolOptions {
+        bool enabled = true;                // false for ncnn's default allocation
+        float size_compare_ratio = 0.f;     // 0 ~ 1, smallest share of a cached buffer a request may use
+        size_t size_drop_threshold = 10;    // cached buffers before the pool returns some to the system
+    };
+
+    /// Memory requests served by the worker pools since they were created
+    struct AllocatorStats {
+        size_t workers{};       // allocator pairs, one per concurrently running detection and input shape
+        size_t frames{};        // inferences run with the pools
+        size_t requests{};      // fastMalloc calls of the extractors
+        size_t mallocs{};       // requests the pools could not serve from their cache
+    };
+
+    /// Pool allocator that counts the requests it could not serve from its cache
+    ///
+    /// A buffer is counted as cached once it is freed to the pool. Buffers the pool drops are
+    /// not tracked, so if the system hands out a dropped address again it is counted as reused.
+    class CountingAllocator : public ncnn::Allocator {
+    public:
+        explicit CountingAllocator(ncnn::Allocator* pool);
+
+        void* fastMalloc(size_t size) override;
+        void fastFree(void* ptr) override;
+
+        size_t requests() const;
+        size_t mallocs() const;
+
+    private:
+        ncnn::Allocator* pool;
+        std::mutex mutex;
+        std::unordered_set<void*> cached;
+        std::atomic<size_t> num_requests;
+        std::atomic<size_t> num_mallocs;
+    };
+
+    /// Blob and workspace allocator of one detection worker
+    ///
+    /// Blobs are extracted as outputs and may be released on another thread, so their pool is
+    /// locked. Workspace buffers never leave the extractor and use the unlocked pool.
+    class WorkerAllocators {
+    public:
+        WorkerAllocators(const PoolOptions &options,
+                         int slot);
+
+        ncnn::Allocator* blob_allocator();
+        ncnn::Allocator* workspace_allocator();
+
+        /// Requests and cache misses of both pools
+        size_t requests() const;
+        size_t mallocs() const;
+
+        /// Input shape slot the pools are sized for
+        const int slot;
+        std::atomic<size_t> frames;
+
+    private:
+        WorkerAllocators(const WorkerAllocators&);
+        WorkerAllocators& operator=(const WorkerAllocators&);
+
+        // declared before the counters, they forward to the pools
+        ncnn::PoolAllocator blob_pool;
+        ncnn::UnlockedPoolAllocator workspace_pool;
+        CountingAllocator blob;
+        CountingAllocator workspace;
+    };
+
+    /// @brief Long-lived allocator pairs handed to the detections that run at the same time
+    ///
+    /// A detection acquires an idle pair for its input shape, or a new one if all are busy, and
+    /// returns it when the extractor is done. The number of pairs therefore stays at the number of
+    /// concurrent detections per shape, and every pair keeps the buffers of its last frame cached.
+    class WorkerAllocatorPool {
+    public:
+        explicit WorkerAllocatorPool(const PoolOptions &options);
+
+        /// @brief Takes an idle allocator pair, the most recently returned one first
+        /// @param slot Input shape slot, pairs are only reused for the same shape
+        WorkerAllocators* acquire(int slot);
+
+        /// @brief Returns a pair acquired with `acquire`
+        void release(WorkerAllocators* allocators);
+
+        AllocatorStats stats() const;
+
+        const PoolOptions& options() const;
+
+    private:
+        WorkerAllocatorPool(const WorkerAllocatorPool&);
+        WorkerAllocatorPool& operator=(const WorkerAllocatorPool&);
+
+        PoolOptions pool_options;
+        mutable std::mutex mutex;
+        std::vector<std::unique_ptr<WorkerAllocators>> workers;
+        std::vector<WorkerAllocators*> idle;
+    };
+
+    /// Holds a worker's allocators for the lifetime of an extractor
+    class WorkerAllocatorLease {
+    public:
+        WorkerAllocatorLease(WorkerAllocatorPool* pool,
+                             int slot);
+        ~WorkerAllocatorLease();
+
+        /// Acquired pair, `nullptr` without a pool
+        WorkerAllocators* allocators;
+
+    private:
+        WorkerAllocatorLease(const WorkerAllocatorLease&);
+        WorkerAllocatorLease& operator=(const WorkerAllocatorLease&);
+
+        WorkerAllocatorPool* pool;
+    };
+}
+
+#endif //NCNN_YOLO_WORKER_ALLOCATORS_H
@@ -4,9 +4,49 @@
 
 #include <benchmark.h>
 #include <libgen.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 #include "YoloV7.h"
+#include "tiling.h"
+#include "input_folding.h"
+#include "detect_queue.h"
+#include "decoder.h"
+#include "proposals.h"
 using namespace Yolo;
 
+/// Forwards to another DataReader and accumulates the time spent in it
+class TimedDataReader : public ncnn::DataReader {
+public:
+    explicit TimedDataReader(const ncnn::DataReader& dr) : dr(dr), time(0)
+    {
+    }
+
+    size_t read(void* buf, size_t size) const override
+    {
+        double start = ncnn::get_current_time();
+        size_t n = dr.read(buf, size);
+        time += ncnn::get_current_time() - start;
+        return n;
+    }
+
+    size_t reference(size_t size, const void** buf) const override
+    {
+        double start = ncnn::get_current_time();
+        size_t n = dr.reference(size, buf);
+        time += ncnn::get_current_time() - start;
+        return n;
+    }
+
+    const ncnn::DataReader& dr;
+    mutable double time;
+};
+
 YoloV7::YoloV7(int target_size, int num_classes, float prob_threshold, float nms_threshold, const std::vector<float> &anchors, const char* path_to_param, const char* path_to_bin)
 {
     this->path_to_param = path_to_param;
@@ -16,83 +56,999 @@ YoloV7::YoloV7(int target_size, int num_classes, float prob_threshold, float nms
     this->prob_threshold = prob_threshold;
     this->nms_threshold = nms_threshold;
     this->anchors = anchors;
+    this->class_names = coco_class_names();
+    this->worker_pools.reset(new WorkerAllocatorPool(PoolOptions()));
+}
+
+YoloV7::YoloV7(const char* path_to_bundle) : YoloV7()
+{
+    this->path_to_param = nullptr;
+    this->path_to_bin = nullptr;
+    this->path_to_bundle = path_to_bundle;
+}
+
+YoloV7::YoloV7(const unsigned char* bundle_data, size_t bundle_size) : YoloV7("embedded bundle")
+{
+    this->bundle_data = bundle_data;
+    this->bundle_size = bundle_size;
+}
+
+YoloV7::~YoloV7()
+{
+    this->async_queue.reset();
+}
+
+const std::vector<std::string>& YoloV7::coco_class_names()
+{
+    static const std::vector<std::string> class_names = {
+        "person", "bicycle", "car", "motorcycle", "airplane", "bus", "train", "truck", "boat", "traffic light",
+        "fire hydrant", "stop sign", "parking meter", "bench", "bird", "cat", "dog", "horse", "sheep", "cow",
+        "elephant", "bear", "zebra", "giraffe", "backpack", "umbrella", "handbag", "tie", "suitcase", "frisbee",
+        "skis", "snowboard", "sports ball", "kite", "baseball bat", "baseball glove", "skateboard", "surfboard",
+        "tennis racket", "bottle", "wine glass", "cup", "fork", "knife", "spoon", "bowl", "banana", "apple",
+        "sandwich", "orange", "broccoli", "carrot", "hot dog", "pizza", "donut", "cake", "chair", "couch",
+        "potted plant", "bed", "dining table", "toilet", "tv", "laptop", "mouse", "remote", "keyboard", "cell phone",
+        "microwave", "oven", "toaster", "sink", "refrigerator", "book", "clock", "vase", "scissors", "teddy bear",
+        "hair drier", "toothbrush"
+    };
+
+    return class_names;
+}
+
+int YoloV7::init(bool use_mmap)
+{
+    set_model(nullptr);
+
+    std::shared_ptr<Model> next = std::make_shared<Model>();
+    configure(*next);
+
+    int ret;
+    if (this->path_to_bundle && !this->class_subset.empty())
+    {
+        fprintf(stderr, "class subsets need param and bin files, specialize the bundle with ncnn_yolov7_subset\n");
+        ret = -1;
+    }
+    else if (this->path_to_bundle)
+    {
+        // embedded bundles are part of the executable, only their header is verified
+        ret = this->bundle_data ? next->bundle.open(this->bundle_data, this->bundle_size, false) : next->bundle.open(this->path_to_bundle);
+        ret = ret || load_bundle(*next, this->path_to_bundle);
+    }
+    else
+    {
+        ret = load_files(*next, this->path_to_param, this->path_to_bin, use_mmap);
+    }
+
+    if (ret || enable_sparse_heads(*next))
+    {
+        return -1;
+    }
+
+    set_model(next);
+
+    return 0;
+}
+
+int YoloV7::share_model(const YoloV7& other)
+{
+    std::shared_ptr<Model> m = other.current_model();
+    if (!m)
+    {
+        fprintf(stderr, "share_model needs an initialized detector\n");
+        return -1;
+    }
+
+    if (model_source() != other.model_source())
+    {
+        fprintf(stderr, "share_model needs a detector with the same model\n");
+        return -1;
+    }
+
+    if (this->path_to_bundle)
+    {
+        // init would take every setting from the bundle, the other detector already did
+        this->target_size = other.target_size;
+        this->num_classes = other.num_classes;
+        this->prob_threshold = other.prob_threshold;
+        this->nms_threshold = other.nms_threshold;
+        this->input_name = other.input_name;
+        this->output_names = other.output_names;
+        this->strides = other.strides;
+        this->anchors = other.anchors;
+        this->class_names = other.class_names;
+    }
+    else if (this->input_name != other.input_name || this->output_names != other.output_names || this->num_classes != other.num_classes ||
+             this->strides != other.strides || this->anchors != other.anchors)
+    {
+        // blob indexes and head layout of the shared model are only valid for the same names, classes and anchors
+        fprintf(stderr, "share_model needs a detector with the same blob names, classes, strides and anchors\n");
+        return -1;
+    }
+
+    // sparse heads leave the channels of cells below their threshold undefined, a lower threshold would decode them
+    if (this->sparse_heads != m->sparse_heads || (m->sparse_heads && this->prob_threshold != m->sparse_threshold))
+    {
+        fprintf(stderr, "share_model needs a detector with the same sparse heads and probability threshold\n");
+        return -1;
+    }
+
+    set_model(m);
+
+    return 0;
+}
+
+std::string YoloV7::model_source() const
+{
+    if (this->bundle_data)
+    {
+        char address[32];
+        snprintf(address, sizeof(address), "%p", (const void*)this->bundle_data);
+        return address;
+    }
+
+    auto real_path = [](const char* path) {
+        char resolved[PATH_MAX];
+        return std::string(realpath(path, resolved) ? resolved : path);
+    };
+
+    if (this->path_to_bundle)
+    {
+        return real_path(this->path_to_bundle);
+    }
+
+    return real_path(this->path_to_param) + "|" + real_path(this->path_to_bin);
+}
+
+int YoloV7::set_threading(const ThreadOptions& options)
+{
+    const int physical_cpus = ncnn::get_physical_cpu_count();
+    if (options.num_threads < 1 || options.num_threads > physical_cpus)
+    {
+        fprintf(stderr, "%d threads requested, %d physical cores available\n", options.num_threads, physical_cpus);
+        return -1;
+    }
+
+    if (options.powersave < 0 || options.powersave > 2 ||
+        (options.powersave == 1 && ncnn::get_little_cpu_count() == 0) ||
+        (options.powersave == 2 && ncnn::get_big_cpu_count() == 0))
+    {
+        fprintf(stderr, "powersave %d is not supported on this cpu\n", options.powersave);
+        return -1;
+    }
+
+#ifdef CPU_SETSIZE
+    const int max_cpus = CPU_SETSIZE;
+#else
+    const int max_cpus = 64;
+#endif
+
+    const int num_pinned = options.affinity.num_enabled();
+    for (int cpu = ncnn::get_cpu_count(); cpu < max_cpus && num_pinned > 0; cpu++)
+    {
+        if (options.affinity.is_enabled(cpu))
+        {
+            fprintf(stderr, "affinity contains cpu %d, only %d cpus available\n", cpu, ncnn::get_cpu_count());
+            return -1;
+        }
+    }
+
+    if (num_pinned > 0 && num_pinned < options.num_threads)
+    {
+        fprintf(stderr, "%d threads pinned to %d cpus\n", options.num_threads, num_pinned);
+        return -1;
+    }
+
+    this->threading = options;
+    this->threading_version++;
+
+    return 0;
+}
+
+ThreadOptions YoloV7::threading_options() const
+{
+    return this->threading;
 }
 
-void YoloV7::detect(const cv::Mat& bgr, std::vector<Object>& objects)
+/// Pins the OpenMP threads of the calling thread once per thread and threading change
+void YoloV7::apply_threading() const
 {
-    ncnn::Net model;
+    if (this->threading_version == 0)
+        return;
+
+    static thread_local const YoloV7* applied_by = nullptr;
+    static thread_local int applied_version = 0;
+    if (applied_by == this && applied_version == this->threading_version)
+        return;
+
+    applied_by = this;
+    applied_version = this->threading_version;
 
-    model.opt.num_threads = 1;
-    model.opt.use_vulkan_compute = false;
+    if (this->threading.affinity.num_enabled() > 0)
+        ncnn::set_cpu_thread_affinity(this->threading.affinity);
+    else
+        ncnn::set_cpu_powersave(this->threading.powersave);
+}
+
+void YoloV7::set_fold_input_normalization(bool enable)
+{
+    this->fold_input_norm = enable;
+}
+
+void YoloV7::set_sparse_heads(bool enable)
+{
+    this->sparse_heads = enable;
+}
+
+SparseHeadStats YoloV7::sparse_head_stats() const
+{
+    SparseHeadStats stats;
+
+    std::shared_ptr<Model> m = current_model();
+    if (m)
+    {
+        for (const SparseHeadConvolution* head : m->heads)
+            if (head->is_sparse())
+                head->add_stats(stats);
+    }
+
+    return stats;
+}
+
+int YoloV7::set_detection_limits(const DetectionLimits& limits)
+{
+    if (limits.max_candidates < 0 || limits.max_detections < 0)
+    {
+        fprintf(stderr, "detection limits must not be negative, got %d and %d\n", limits.max_candidates, limits.max_detections);
+        return -1;
+    }
+
+    this->limits = limits;
+
+    return 0;
+}
+
+int YoloV7::set_class_subset(const std::vector<int>& class_ids)
+{
+    if (!class_ids.empty() && check_class_ids(class_ids, this->num_classes))
+        return -1;
+
+    this->class_subset = class_ids;
+
+    return 0;
+}
+
+void YoloV7::set_allocators(ncnn::Allocator* blob_allocator, ncnn::Allocator* workspace_allocator)
+{
+    this->blob_allocator = blob_allocator;
+    this->workspace_allocator = workspace_allocator;
+}
+
+int YoloV7::set_pool_options(const PoolOptions& options)
+{
+    if (options.size_compare_ratio < 0.f || options.size_compare_ratio > 1.f)
+    {
+        fprintf(stderr, "size compare ratio %f is outside 0 ~ 1\n", options.size_compare_ratio);
+        return -1;
+    }
+
+    this->worker_pools.reset(new WorkerAllocatorPool(options));
+
+    return 0;
+}
+
+AllocatorStats YoloV7::allocator_stats() const
+{
+    return this->worker_pools->stats();
+}
+
+void YoloV7::configure(Model& m) const
+{
+    m.net.opt.num_threads = this->threading.num_threads;
+    m.net.opt.use_vulkan_compute = false;
     // yolov7.opt.use_bf16_storage = true;
 
-    if(model.load_param(this->path_to_param) || model.load_model(this->path_to_bin))
+    // every convolution goes through the proxy, the heads are switched to sparse once the outputs are known
+    if (this->sparse_heads)
+        SparseHeadConvolution::register_on(m.net, m.heads);
+}
+
+int YoloV7::load_files(Model& m, const char* path_to_param, const char* path_to_bin, bool use_mmap)
+{
+    if (!this->class_subset.empty())
+        return load_class_subset(m, path_to_param, path_to_bin);
+
+    double start = ncnn::get_current_time();
+
+    if (m.net.load_param(path_to_param))
+    {
+        fprintf(stderr, "load_param %s failed\n", path_to_param);
+        return -1;
+    }
+
+    m.times.param_parse = ncnn::get_current_time() - start;
+
+    int ret;
+    if (use_mmap)
+    {
+        ret = m.weights_reader.open(path_to_bin) || load_weights(m, m.weights_reader);
+    }
+    else
+    {
+        FILE* fp = fopen(path_to_bin, "rb");
+        ret = -1;
+        if (fp)
+        {
+            ret = load_weights(m, ncnn::DataReaderFromStdio(fp));
+            fclose(fp);
+        }
+    }
+
+    if (ret)
     {
-        exit(-1);
+        fprintf(stderr, "load_model %s failed\n", path_to_bin);
+        return -1;
     }
 
+    return resolve_blob_indexes(m);
+}
+
+int YoloV7::load_class_subset(Model& m, const char* path_to_param, const char* path_to_bin)
+{
+    double start = ncnn::get_current_time();
+
+    ClassSubset subset;
+    subset.class_ids = this->class_subset;
+    subset.num_classes = this->num_classes;
+    subset.output_names = this->output_names;
+
+    // the sliced weights are kept in the model, the network references them like a mapped file
+    std::string param;
+    if (slice_class_subset_files(subset, path_to_param, path_to_bin, param, m.sliced_weights) || m.net.load_param_mem(param.c_str()))
+    {
+        fprintf(stderr, "class subset of %s failed\n", path_to_param);
+        return -1;
+    }
+
+    m.times.param_parse = ncnn::get_current_time() - start;
+
+    const unsigned char* model = m.sliced_weights.data();
+    if (load_weights(m, ncnn::DataReaderFromMemory(model)))
+    {
+        fprintf(stderr, "load_model %s failed\n", path_to_bin);
+        return -1;
+    }
+
+    m.class_ids = this->class_subset;
+
+    return resolve_blob_indexes(m);
+}
+
+int YoloV7::load_bundle(Model& m, const char* name)
+{
+    const BundleConfig& config = m.bundle.config();
+
+    // binary param and weights are referenced straight from the mapping, no parsing and no copies
+    size_t param_size = 0;
+    size_t model_size = 0;
+    const unsigned char* param = m.bundle.section(BUNDLE_SECTION_PARAM, &param_size);
+    const unsigned char* model = m.bundle.section(BUNDLE_SECTION_MODEL, &model_size);
+
+    double start = ncnn::get_current_time();
+
+    int ret = m.net.load_param(param) != (int)param_size;
+
+    m.times.param_parse = ncnn::get_current_time() - start;
+
+    // load_model(const unsigned char*) through a DataReader, to tell weight access and pipeline creation apart
+    const unsigned char* model_end = model;
+    if (!ret)
+    {
+        ret = load_weights(m, ncnn::DataReaderFromMemory(model_end)) || model_end - model != (ptrdiff_t)model_size;
+    }
+
+    if (ret)
+    {
+        fprintf(stderr, "load bundle %s failed\n", name);
+        return -1;
+    }
+
+    this->target_size = config.target_size;
+    this->num_classes = config.num_classes;
+    this->prob_threshold = config.prob_threshold;
+    this->nms_threshold = config.nms_threshold;
+    this->input_name = config.input_name;
+    this->output_names.clear();
+    this->strides.clear();
+    this->anchors.clear();
+    m.input_index = config.input_index;
+    m.output_indexes.clear();
+    for (int i = 0; i < config.num_outputs; i++)
+    {
+        this->output_names.emplace_back(config.output_names[i]);
+        this->strides.push_back(config.strides[i]);
+        this->anchors.insert(this->anchors.end(), config.anchors + i * 6, config.anchors + i * 6 + 6);
+        m.output_indexes.push_back(config.output_indexes[i]);
+    }
+
+    std::vector<std::string> labels = m.bundle.labels();
+    if (!labels.empty())
+    {
+        this->class_names = labels;
+    }
+
+    if ((int)this->class_names.size() < this->num_classes)
+    {
+        fprintf(stderr, "bundle %s has %d labels for %d classes\n", name, (int)this->class_names.size(), this->num_classes);
+        return -1;
+    }
+
+    return 0;
+}
+
+int YoloV7::load_weights(Model& m, const ncnn::DataReader& dr)
+{
+    // the first convolution's weights are scaled on their way in, the input is then fed as 0..255
+    InputScaleFoldingReader folding_dr(dr, 1 / 255.f);
+    const bool fold = this->fold_input_norm && InputScaleFoldingReader::can_fold(m.net);
+    if (this->fold_input_norm && !fold)
+        fprintf(stderr, "the input normalization cannot be folded into this model\n");
+
+    TimedDataReader timed_dr(fold ? (const ncnn::DataReader&)folding_dr : dr);
+
+    double start = ncnn::get_current_time();
+    int ret = m.net.load_model(timed_dr);
+    double end = ncnn::get_current_time();
+
+    m.times.weight_load = timed_dr.time;
+    m.times.pipeline_creation = end - start - timed_dr.time;
+    m.input_norm = fold && folding_dr.folded() ? 1.f : 1 / 255.f;
+
+    return ret;
+}
+
+int YoloV7::warmup(int n, int w, int h)
+{
+    std::shared_ptr<Model> m = current_model();
+    if (!m)
+    {
+        fprintf(stderr, "YoloV7 is not initialized, call init() first\n");
+        return -1;
+    }
+
+    return warmup(*m, n, w, h);
+}
+
+int YoloV7::warmup(Model& m, int n, int w, int h)
+{
+    cv::Mat frame(h > 0 ? h : this->target_size, w > 0 ? w : this->target_size, CV_8UC3);
+    frame = cv::Scalar(114, 114, 114);
+
+    std::vector<Object> objects;
+    double steady = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double start = ncnn::get_current_time();
+        if (detect(m, frame, objects))
+            return -1;
+        double t = ncnn::get_current_time() - start;
+
+        if (i == 0)
+            m.times.first_inference = t;
+        else
+            steady += t;
+    }
+
+    m.times.steady_inference = n > 1 ? steady / (n - 1) : 0;
+
+    return 0;
+}
+
+StartupTimes YoloV7::startup_times() const
+{
+    std::shared_ptr<Model> m = current_model();
+    return m ? m->times : StartupTimes();
+}
+
+int YoloV7::swap_model(const char* path_to_param, const char* path_to_bin, int warmup_runs)
+{
+    std::shared_ptr<Model> next = std::make_shared<Model>();
+
+    configure(*next);
+
+    if (load_files(*next, path_to_param, path_to_bin, true) || enable_sparse_heads(*next) || warmup(*next, warmup_runs, 0, 0))
+    {
+        return -1;
+    }
+
+    // detections that already hold the old model finish on it, it is released with their last reference
+    set_model(next);
+
+    return 0;
+}
+
+std::future<int> YoloV7::swap_model_async(const std::string& path_to_param, const std::string& path_to_bin, int warmup_runs)
+{
+    return std::async(std::launch::async, [this, path_to_param, path_to_bin, warmup_runs]() {
+        return swap_model(path_to_param.c_str(), path_to_bin.c_str(), warmup_runs);
+    });
+}
+
+std::shared_ptr<Model> YoloV7::current_model() const
+{
+    std::lock_guard<std::mutex> lock(this->model_mutex);
+    return this->model;
+}
+
+void YoloV7::set_model(const std::shared_ptr<Model>& next)
+{
+    std::shared_ptr<Model> previous;
+    {
+        std::lock_guard<std::mutex> lock(this->model_mutex);
+        previous = this->model;
+        this->model = next;
+    }
+
+    // the previous model, if this was its last reference, is destroyed here outside of the lock
+}
+
+static int find_blob_index(const std::vector<const char*>& names, const std::vector<int>& indexes, const std::string& name)
+{
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (name == names[i])
+            return indexes[i];
+    }
+
+    return -1;
+}
+
+int YoloV7::resolve_blob_indexes(Model& m)
+{
+    m.input_index = find_blob_index(m.net.input_names(), m.net.input_indexes(), this->input_name);
+    if (m.input_index < 0)
+    {
+        fprintf(stderr, "input blob %s not found\n", this->input_name.c_str());
+        return -1;
+    }
+
+    if (this->output_names.size() != this->strides.size() || this->anchors.size() != this->strides.size() * 6)
+    {
+        fprintf(stderr, "%d outputs need as many strides and 6 anchors each\n", (int)this->output_names.size());
+        return -1;
+    }
+
+    m.output_indexes.clear();
+    for (const auto& name : this->output_names)
+    {
+        int index = find_blob_index(m.net.output_names(), m.net.output_indexes(), name);
+        if (index < 0)
+        {
+            fprintf(stderr, "output blob %s not found\n", name.c_str());
+            return -1;
+        }
+        m.output_indexes.push_back(index);
+    }
+
+    return 0;
+}
+
+int YoloV7::enable_sparse_heads(Model& m) const
+{
+    if (!this->sparse_heads)
+        return 0;
+
+    const int num_anchors = 3;
+    const int num_classes = model_classes(m);
+    const float box_threshold = objectness_threshold(this->prob_threshold);
+
+    // only heads that produce a network output, their undefined values are never read by another layer
+    int num_sparse = 0;
+    for (SparseHeadConvolution* head : m.heads)
+    {
+        const bool is_output = head->tops.size() == 1 &&
+                               std::find(m.output_indexes.begin(), m.output_indexes.end(), head->tops[0]) != m.output_indexes.end();
+
+        // every other convolution runs on ncnn's repacked weights, the original ones would double its memory
+        if (!is_output || !head->is_head(num_anchors, num_classes))
+        {
+            head->release_weights();
+            continue;
+        }
+
+        head->set_sparse(num_anchors, num_classes, box_threshold);
+        num_sparse++;
+    }
+
+    m.sparse_heads = num_sparse > 0;
+    m.sparse_threshold = this->prob_threshold;
+
+    if (num_sparse < (int)m.output_indexes.size())
+        fprintf(stderr, "%d of %d detection heads are evaluated sparsely\n", num_sparse, (int)m.output_indexes.size());
+
+    return 0;
+}
+
+bool YoloV7::is_initialized() const
+{
+    return current_model() != nullptr;
+}
+
+int YoloV7::detect(const cv::Mat& bgr, std::vector<Object>& objects)
+{
+    // keeps the model alive until this detection is done, even if it is swapped meanwhile
+    std::shared_ptr<Model> m = current_model();
+    if (!m)
+    {
+        fprintf(stderr, "YoloV7 is not initialized, call init() first\n");
+        return -1;
+    }
+
+    return detect(*m, bgr, objects);
+}
+
+int YoloV7::detect(Model& m, const cv::Mat& bgr, std::vector<Object>& objects)
+{
     int img_w = bgr.cols;
     int img_h = bgr.rows;
 
     const int max_stride = 64;
 
-    // letterbox pad to multiple of max_stride
-    int w = img_w;
-    int h = img_h;
-    float scale;
-    if (w > h)
+    // letterbox pad to multiple of max_stride, resize, border and normalization in one pass
+    Letterbox lb = make_letterbox(img_w, img_h, this->target_size, max_stride);
+    ncnn::Mat& in_pad = input_buffer(fit_bucket(lb));
+    letterbox_bgr2rgb(bgr.data, img_w * 3, lb, in_pad, 114.f, m.input_norm);
+
+    return detect(m, lb, in_pad, objects);
+}
+
+int YoloV7::detect(const ScaledImage& image, std::vector<Object>& objects)
+{
+    std::shared_ptr<Model> m = current_model();
+    if (!m)
     {
-        scale = (float)this->target_size / w;
-        w = this->target_size;
-        h = h * scale;
+        fprintf(stderr, "YoloV7 is not initialized, call init() first\n");
+        return -1;
     }
-    else
+
+    const int max_stride = 64;
+
+    Letterbox lb = make_letterbox(image.bgr.cols, image.bgr.rows, this->target_size, max_stride);
+    ncnn::Mat& in_pad = input_buffer(fit_bucket(lb));
+    letterbox_bgr2rgb(image.bgr.data, image.bgr.cols * 3, lb, in_pad, 114.f, m->input_norm);
+
+    // project the boxes back onto the original image instead of the decoded one
+    Letterbox original = lb;
+    original.img_w = image.width;
+    original.img_h = image.height;
+    original.scale = lb.scale * image.scale();
+
+    return detect(*m, original, in_pad, objects);
+}
+
+int YoloV7::detect_tiled(const cv::Mat& bgr, std::vector<Object>& objects, const TileOptions& options)
+{
+    std::shared_ptr<Model> m = current_model();
+    if (!m)
+    {
+        fprintf(stderr, "YoloV7 is not initialized, call init() first\n");
+        return -1;
+    }
+
+    if (options.tile_size <= 0 || options.overlap < 0 || options.overlap >= options.tile_size)
     {
-        scale = (float)this->target_size / h;
-        h = this->target_size;
-        w = w * scale;
+        fprintf(stderr, "invalid tile size %d with overlap %d\n", options.tile_size, options.overlap);
+        return -1;
     }
 
-    ncnn::Mat in = ncnn::Mat::from_pixels_resize(bgr.data, ncnn::Mat::PIXEL_BGR2RGB, img_w, img_h, w, h);
+    const int max_stride = 64;
 
-    // pad to target_size rectangle
-    int wpad = (w + max_stride - 1) / max_stride * max_stride - w;
-    int hpad = (h + max_stride - 1) / max_stride * max_stride - h;
-    ncnn::Mat in_pad;
-    ncnn::copy_make_border(in, in_pad, hpad / 2, hpad - hpad / 2, wpad / 2, wpad - wpad / 2, ncnn::BORDER_CONSTANT, 114.f);
+    std::vector<cv::Rect> tiles = make_tiles(bgr.cols, bgr.rows, options.tile_size, options.overlap);
 
-    const float norm_vals[3] = {1 / 255.f, 1 / 255.f, 1 / 255.f};
-    in_pad.substract_mean_normalize(nullptr, norm_vals);
+    std::vector<TileResult> results(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++)
+        results[i].tile = tiles[i];
+    if (options.full_frame && tiles.size() > 1)
+        results.push_back({cv::Rect(0, 0, bgr.cols, bgr.rows), {}});
 
-    std::vector<Object> proposals;
+    // the tiles are letterboxed straight out of the image, the row stride skips the rest of it
+    std::atomic<int> next(0);
+    std::atomic<int> failed(0);
+    auto worker = [&]() {
+        for (int i = next++; i < (int)results.size(); i = next++)
+        {
+            const cv::Rect& tile = results[i].tile;
+
+            Letterbox lb = make_letterbox(tile.width, tile.height, this->target_size, max_stride);
+            ncnn::Mat& in_pad = input_buffer(fit_bucket(lb));
+            letterbox_bgr2rgb(bgr.data + (tile.y * bgr.cols + tile.x) * 3, bgr.cols * 3, lb, in_pad, 114.f, m->input_norm);
+
+            if (detect(*m, lb, in_pad, results[i].objects))
+            {
+                failed++;
+                continue;
+            }
+
+            for (Object& obj : results[i].objects)
+            {
+                obj.rect.x += tile.x;
+                obj.rect.y += tile.y;
+            }
+        }
+    };
+
+    const int num_threads = std::max(std::min(options.num_threads, (int)results.size()), 1);
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    if (failed)
+        return -1;
+
+    merge_tiles(results, bgr.cols, bgr.rows, this->nms_threshold, options.seam_threshold, objects);
+
+    return 0;
+}
+
+int YoloV7::load_image(const char* path, ScaledImage& image) const
+{
+    return load_image_scaled(path, this->target_size, image);
+}
+
+int YoloV7::set_input_buckets(const std::vector<std::pair<int, int>>& shapes)
+{
+    const int max_stride = this->strides.back();
+
+    std::vector<InputBucket> next;
+    for (const auto& shape : shapes)
+    {
+        if (shape.first <= 0 || shape.second <= 0 || shape.first % max_stride || shape.second % max_stride)
+        {
+            fprintf(stderr, "input bucket %dx%d is not a multiple of stride %d\n", shape.first, shape.second, max_stride);
+            return -1;
+        }
+
+        InputBucket bucket;
+        bucket.w = shape.first;
+        bucket.h = shape.second;
+        next.push_back(bucket);
+    }
+
+    // smallest first, the first bucket that fits is the tightest one
+    std::sort(next.begin(), next.end(), [](const InputBucket& a, const InputBucket& b) {
+        return a.w * a.h < b.w * b.h;
+    });
+
+    this->buckets = std::move(next);
+
+    return 0;
+}
+
+/// Pads the letterbox to the smallest fitting bucket
+/// @return input buffer slot, `0` if no bucket fits
+int YoloV7::fit_bucket(Letterbox& lb) const
+{
+    for (size_t i = 0; i < this->buckets.size(); i++)
+    {
+        if (pad_letterbox(lb, this->buckets[i].w, this->buckets[i].h))
+            return i + 1;
+    }
+
+    return 0;
+}
+
+ncnn::Mat& YoloV7::input_buffer(int slot)
+{
+    // per thread and bucket, only reallocated when the input shape changes
+    static thread_local std::vector<ncnn::Mat> buffers;
+    if (slot >= (int)buffers.size())
+        buffers.resize(slot + 1);
+
+    return buffers[slot];
+}
+
+int YoloV7::detect_yuv420sp(const unsigned char* yuv420sp, int w, int h, std::vector<Object>& objects, bool nv21)
+{
+    if (w % 2 || h % 2)
+    {
+        fprintf(stderr, "detect_yuv420sp needs an even frame size, got %dx%d\n", w, h);
+        return -1;
+    }
+
+    std::shared_ptr<Model> m = current_model();
+    if (!m)
+    {
+        fprintf(stderr, "YoloV7 is not initialized, call init() first\n");
+        return -1;
+    }
+
+    const int max_stride = 64;
+
+    // resized and converted straight from the camera planes, no full resolution image is created
+    Letterbox lb = make_letterbox(w, h, this->target_size, max_stride);
+    ncnn::Mat& in_pad = input_buffer(fit_bucket(lb));
+    letterbox_yuv420sp2rgb(yuv420sp, lb, in_pad, nv21, 114.f, m->input_norm);
+
+    return detect(*m, lb, in_pad, objects);
+}
 
+int YoloV7::detect(Model& m, const Letterbox& lb, const ncnn::Mat& in_pad, std::vector<Object>& objects)
+{
+    std::vector<ncnn::Mat> outputs;
+    if (infer(m, in_pad, outputs))
+        return -1;
+
+    postprocess(m, lb, in_pad, outputs, objects);
+
+    return 0;
+}
+
+std::future<std::vector<Object>> YoloV7::detect_async(const cv::Mat& bgr)
+{
+    DetectQueue* queue;
+    {
+        std::lock_guard<std::mutex> lock(this->async_mutex);
+        if (!this->async_queue)
+        {
+            auto detect = [this](const cv::Mat& frame, std::vector<Object>& objects) {
+                return this->detect(frame, objects);
+            };
+            this->async_queue.reset(new DetectQueue(detect, this->async_options));
+        }
+        queue = this->async_queue.get();
+    }
+
+    // outside the lock, a blocking submit must not hold up other callers
+    return queue->submit(bgr);
+}
+
+int YoloV7::set_async_options(const AsyncOptions& options)
+{
+    if (options.num_workers < 1 || options.queue_size < 1)
+    {
+        fprintf(stderr, "detect_async needs at least one worker and queue slot, got %d and %d\n", options.num_workers, options.queue_size);
+        return -1;
+    }
+
+    std::unique_ptr<DetectQueue> previous;
+    {
+        std::lock_guard<std::mutex> lock(this->async_mutex);
+        this->async_options = options;
+        previous = std::move(this->async_queue);
+    }
+
+    return 0;
+}
+
+AsyncStats YoloV7::async_stats() const
+{
+    std::lock_guard<std::mutex> lock(this->async_mutex);
+    return this->async_queue ? this->async_queue->stats() : AsyncStats();
+}
+
+int YoloV7::preprocess(const cv::Mat& bgr, DetectionState& state)
+{
+    state.model = current_model();
+    if (!state.model)
+    {
+        fprintf(stderr, "YoloV7 is not initialized, call init() first\n");
+        return -1;
+    }
+
+    const int max_stride = 64;
+
+    state.lb = make_letterbox(bgr.cols, bgr.rows, this->target_size, max_stride);
+    fit_bucket(state.lb);
+    letterbox_bgr2rgb(bgr.data, bgr.cols * 3, state.lb, state.in, 114.f, state.model->input_norm);
+
+    return 0;
+}
+
+int YoloV7::infer(DetectionState& state)
+{
+    if (!state.model)
+        return -1;
+
+    return infer(*state.model, state.in, state.outputs);
+}
+
+int YoloV7::postprocess(DetectionState& state, std::vector<Object>& objects)
+{
+    // the model is released by the first postprocess of a detection
+    if (!state.model || state.outputs.size() != this->strides.size())
+        return -1;
+
+    postprocess(*state.model, state.lb, state.in, state.outputs, objects);
+
+    // the model may be released once its last detection is done
+    state.model.reset();
+
+    return 0;
+}
+
+int YoloV7::infer(Model& m, const ncnn::Mat& in_pad, std::vector<ncnn::Mat>& outputs)
+{
     double inference_time = 0;
     double start = ncnn::get_current_time();
 
-    ncnn::Extractor ex = model.create_extractor();
-    ex.input("in0", in_pad);
+    apply_threading();
+
+    // bucketed inputs get pools of their own, so every shape reuses the buffers of its last frame
+    int slot = 0;
+    for (size_t i = 0; i < this->buckets.size(); i++)
+    {
+        if (this->buckets[i].w == in_pad.w && this->buckets[i].h == in_pad.h)
+        {
+            slot = i + 1;
+            break;
+        }
+    }
+
+    // declared before the extractor, the pair is only handed to another worker once the extractor is gone
+    const bool use_pools = !this->blob_allocator && !this->workspace_allocator && this->worker_pools->options().enabled;
+    WorkerAllocatorLease lease(use_pools ? this->worker_pools.get() : nullptr, slot);
+
+    ncnn::Extractor ex = m.net.create_extractor();
+    ex.set_num_threads(this->threading.num_threads);
+    if (this->blob_allocator)
+        ex.set_blob_allocator(this->blob_allocator);
+    if (this->workspace_allocator)
+        ex.set_workspace_allocator(this->workspace_allocator);
+    if (lease.allocators)
+    {
+        ex.set_blob_allocator(lease.allocators->blob_allocator());
+        ex.set_workspace_allocator(lease.allocators->workspace_allocator());
+        lease.allocators->frames++;
+    }
+    ex.input(m.input_index, in_pad);
 
     double end = ncnn::get_current_time();
     inference_time += end - start;
 
-    // stride 8
-    YoloV7::extract_proposals(ex, "out0", 0, 8, in_pad, proposals, &inference_time);
-
-    // stride 16
-    YoloV7::extract_proposals(ex, "out1", 6, 16, in_pad, proposals, &inference_time);
+    // stride 8, 16 and 32 for the default model
+    outputs.resize(m.output_indexes.size());
+    for (size_t i = 0; i < m.output_indexes.size(); i++)
+    {
+        if (ex.extract(m.output_indexes[i], outputs[i]))
+            return -1;
+    }
 
-    // stride 32
-    YoloV7::extract_proposals(ex, "out2", 12, 32, in_pad, proposals, &inference_time);
+    inference_time += ncnn::get_current_time() - end;
 
     // Print measured time
     fprintf(stderr, "Inference time = %.5f ms\n", inference_time);
 
-    // sort all proposals by score from highest to lowest
-    qsort_descent_inplace(proposals);
+    return 0;
+}
+
+int YoloV7::model_classes(const Model& m) const
+{
+    return m.class_ids.empty() ? this->num_classes : (int)m.class_ids.size();
+}
+
+void YoloV7::postprocess(const Model& m, const Letterbox& lb, const ncnn::Mat& in_pad, const std::vector<ncnn::Mat>& outputs, std::vector<Object>& objects)
+{
+    std::vector<Object> proposals;
+
+    // three anchors per stride
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        ncnn::Mat anchors(6);
+        for (int k = 0; k < 6; k++)
+            anchors[k] = this->anchors[i * 6 + k];
+
+        generate_proposals(anchors, this->strides[i], in_pad, outputs[i], model_classes(m), proposals);
+    }
+
+    // sort the most probable proposals by score from highest to lowest, the others would mostly be suppressed
+    sort_top_proposals(proposals, this->limits.max_candidates);
 
     // apply nms with nms_threshold
     std::vector<int> picked;
-    nms_sorted_bboxes(proposals, picked);
+    nms_sorted_bboxes(proposals, picked, this->limits.max_detections);
 
     int count = picked.size();
 
@@ -101,17 +1057,21 @@ void YoloV7::detect(const cv::Mat& bgr, std::vector<Object>& objects)
     {
         objects[i] = proposals[picked[i]];
 
+        // labels of a class subset are positions in it
+        if (!m.class_ids.empty())
+            objects[i].label = m.class_ids[objects[i].label];
+
         // adjust offset to original unpadded
-        float x0 = (objects[i].rect.x - (wpad / 2)) / scale;
-        float y0 = (objects[i].rect.y - (hpad / 2)) / scale;
-        float x1 = (objects[i].rect.x + objects[i].rect.width - (wpad / 2)) / scale;
-        float y1 = (objects[i].rect.y + objects[i].rect.height - (hpad / 2)) / scale;
+        float x0 = (objects[i].rect.x - lb.left()) / lb.scale;
+        float y0 = (objects[i].rect.y - lb.top()) / lb.scale;
+        float x1 = (objects[i].rect.x + objects[i].rect.width - lb.left()) / lb.scale;
+        float y1 = (objects[i].rect.y + objects[i].rect.height - lb.top()) / lb.scale;
 
         // clip
-        x0 = std::max(std::min(x0, (float)(img_w - 1)), 0.f);
-        y0 = std::max(std::min(y0, (float)(img_h - 1)), 0.f);
-        x1 = std::max(std::min(x1, (float)(img_w - 1)), 0.f);
-        y1 = std::max(std::min(y1, (float)(img_h - 1)), 0.f);
+        x0 = std::max(std::min(x0, (float)(lb.img_w - 1)), 0.f);
+        y0 = std::max(std::min(y0, (float)(lb.img_h - 1)), 0.f);
+        x1 = std::max(std::min(x1, (float)(lb.img_w - 1)), 0.f);
+        y1 = std::max(std::min(y1, (float)(lb.img_h - 1)), 0.f);
 
         objects[i].rect.x = x0;
         objects[i].rect.y = y0;
@@ -122,19 +1082,6 @@ void YoloV7::detect(const cv::Mat& bgr, std::vector<Object>& objects)
 
 void YoloV7::draw_objects(const cv::Mat& bgr, const std::vector<Object>& objects)
 {
-    // class names
-    static const char* class_names[] = {
-        "person", "bicycle", "car", "motorcycle", "airplane", "bus", "train", "truck", "boat", "traffic light",
-        "fire hydrant", "stop sign", "parking meter", "bench", "bird", "cat", "dog", "horse", "sheep", "cow",
-        "elephant", "bear", "zebra", "giraffe", "backpack", "umbrella", "handbag", "tie", "suitcase", "frisbee",
-        "skis", "snowboard", "sports ball", "kite", "baseball bat", "baseball glove", "skateboard", "surfboard",
-        "tennis racket", "bottle", "wine glass", "cup", "fork", "knife", "spoon", "bowl", "banana", "apple",
-        "sandwich", "orange", "broccoli", "carrot", "hot dog", "pizza", "donut", "cake", "chair", "couch",
-        "potted plant", "bed", "dining table", "toilet", "tv", "laptop", "mouse", "remote", "keyboard", "cell phone",
-        "microwave", "oven", "toaster", "sink", "refrigerator", "book", "clock", "vase", "scissors", "teddy bear",
-        "hair drier", "toothbrush"
-    };
-
     // colors
     static const unsigned char colors[19][3] = {
         {54, 67, 244},
@@ -177,7 +1124,7 @@ void YoloV7::draw_objects(const cv::Mat& bgr, const std::vector<Object>& objects
         cv::rectangle(image, obj.rect, cc, 2);
 
         char text[256];
-        snprintf(text, 256, "%s %.1f%%", class_names[obj.label], obj.prob * 100);
+        snprintf(text, 256, "%s %.1f%%", this->class_names[obj.label].c_str(), obj.prob * 100);
 
         int baseLine = 0;
         cv::Size label_size = cv::getTextSize(text, cv::FONT_HERSHEY_SIMPLEX, 0.4, 1, &baseLine);
@@ -208,52 +1155,7 @@ float YoloV7::intersection_area(const Object& a, const Object& b)
     return inter.area();
 }
 
-void YoloV7::qsort_descent_inplace(std::vector<Object>& objects, int left, int right)
-{
-    int i = left;
-    int j = right;
-    float p = objects[(left + right) / 2].prob;
-
-    while (i <= j)
-    {
-        while (objects[i].prob > p)
-            i++;
-
-        while (objects[j].prob < p)
-            j--;
-
-        if (i <= j)
-        {
-            // swap
-            std::swap(objects[i], objects[j]);
-
-            i++;
-            j--;
-        }
-    }
-
-#pragma omp parallel sections
-    {
-#pragma omp section
-        {
-            if (left < j) qsort_descent_inplace(objects, left, j);
-        }
-#pragma omp section
-        {
-            if (i < right) qsort_descent_inplace(objects, i, right);
-        }
-    }
-}
-
-void YoloV7::qsort_descent_inplace(std::vector<Object>& objects)
-{
-    if (objects.empty())
-        return;
-
-    qsort_descent_inplace(objects, 0, objects.size() - 1);
-}
-
-void YoloV7::nms_sorted_bboxes(const std::vector<Object>& faceobjects, std::vector<int>& picked,  bool agnostic)
+void YoloV7::nms_sorted_bboxes(const std::vector<Object>& faceobjects, std::vector<int>& picked, int max_picked, bool agnostic)
 {
     picked.clear();
 
@@ -287,101 +1189,17 @@ void YoloV7::nms_sorted_bboxes(const std::vector<Object>& faceobjects, std::vect
 
         if (keep)
             picked.push_back(i);
-    }
-}
-
-float YoloV7::sigmoid(float x)
-{
-    return static_cast<float>(1.f / (1.f + exp(-x)));
-}
 
-void YoloV7::generate_proposals(const ncnn::Mat& anchors, int stride, const ncnn::Mat& in_pad, const ncnn::Mat& feat_blob, std::vector<Object>& objects)
-{
-    const int num_grid_x = feat_blob.w;
-    const int num_grid_y = feat_blob.h;
-
-    const int num_anchors = anchors.w / 2;
-
-    for (int q = 0; q < num_anchors; q++)
-    {
-        const int num_output = q * (this->num_classes + 5);
-        const float anchor_w = anchors[q * 2];
-        const float anchor_h = anchors[q * 2 + 1];
-
-        for (int i = 0; i < num_grid_y; i++)
-        {
-            for (int j = 0; j < num_grid_x; j++)
-            {
-                // find class index with max class score
-                int class_index = 0;
-                float class_score = -FLT_MAX;
-                for (int k = 0; k < this->num_classes; k++)
-                {
-                    float score = feat_blob.channel(num_output + 5 + k).row(i)[j];
-                    if (score > class_score)
-                    {
-                        class_index = k;
-                        class_score = score;
-                    }
-                }
-
-                float box_score = feat_blob.channel(num_output + 4).row(i)[j];
-
-                float confidence = sigmoid(box_score) * sigmoid(class_score);
-
-                if (confidence >= this->prob_threshold)
-                {
-                    float dx = sigmoid(feat_blob.channel(num_output + 0).row(i)[j]);
-                    float dy = sigmoid(feat_blob.channel(num_output + 1).row(i)[j]);
-                    float dw = sigmoid(feat_blob.channel(num_output + 2).row(i)[j]);
-                    float dh = sigmoid(feat_blob.channel(num_output + 3).row(i)[j]);
-
-                    float pb_cx = (dx * 2.f - 0.5f + j) * stride;
-                    float pb_cy = (dy * 2.f - 0.5f + i) * stride;
-
-                    float pb_w = pow(dw * 2.f, 2) * anchor_w;
-                    float pb_h = pow(dh * 2.f, 2) * anchor_h;
-
-                    float x0 = pb_cx - pb_w * 0.5f;
-                    float y0 = pb_cy - pb_h * 0.5f;
-                    float x1 = pb_cx + pb_w * 0.5f;
-                    float y1 = pb_cy + pb_h * 0.5f;
-
-                    Object obj;
-                    obj.rect.x = x0;
-                    obj.rect.y = y0;
-                    obj.rect.width = x1 - x0;
-                    obj.rect.height = y1 - y0;
-                    obj.label = class_index;
-                    obj.prob = confidence;
-
-                    objects.push_back(obj);
-                }
-            }
-        }
+        // the rest is less probable than every box already picked
+        if (max_picked > 0 && (int)picked.size() == max_picked)
+            break;
     }
 }
 
-void YoloV7::extract_proposals(ncnn::Extractor& ex, const char* output_name, int anchor_idx, int stride, const ncnn::Mat& in_pad, std::vector<Object>& proposals, double* inference_time)
+void YoloV7::generate_proposals(const ncnn::Mat& anchors, int stride, const ncnn::Mat& in_pad, const ncnn::Mat& feat_blob, int num_classes, std::vector<Object>& objects)
 {
-    double start = ncnn::get_current_time();
-    ncnn::Mat out;
-    ex.extract(output_name, out);
-    double end = ncnn::get_current_time();
-    *inference_time += end - start;
-
-    ncnn::Mat anchors(6);
-    anchors[0] = this->anchors[anchor_idx + 0];
-    anchors[1] = this->anchors[anchor_idx + 1];
-    anchors[2] = this->anchors[anchor_idx + 2];
-    anchors[3] = this->anchors[anchor_idx + 3];
-    anchors[4] = this->anchors[anchor_idx + 4];
-    anchors[5] = this->anchors[anchor_idx + 5];
-
-    std::vector<Object> objects;
-    generate_proposals(anchors, stride, in_pad, out, objects);
-
-    proposals.insert(proposals.end(), objects.begin(), objects.end());
+    // objectness first, classes and boxes only for the cells that can still pass, see decoder.h
+    decode_proposals(feat_blob, anchors, anchors.w / 2, stride, num_classes, this->prob_threshold, objects);
 }
 
 void YoloV7::write_objects(const std::vector<Object>& objects, char* filename)
@@ -6,12 +6,26 @@
 #define NCNN_YOLO_YOLOV7_H
 
 #include "net.h"
+#include "cpu.h"
+#include "allocator.h"
 #include "simpleocv.h"
+#include "mmap_datareader.h"
+#include "bundle.h"
+#include "preprocess.h"
+#include "image_loader.h"
+#include "worker_allocators.h"
+#include "sparse_head.h"
+#include "class_subset.h"
 
 #include <unistd.h>
 
 #include <cfloat>
 #include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace Yolo {
@@ -22,6 +36,92 @@ namespace Yolo {
         float prob{};
     };
 
+    /// Durations of the startup phases in ms, filled by `init` and `warmup`
+    struct StartupTimes {
+        double param_parse{};
+        double weight_load{};           // time spent inside the DataReader
+        double pipeline_creation{};     // rest of load_model, mostly create_pipeline
+        double first_inference{};
+        double steady_inference{};      // average over the remaining warmup runs
+    };
+
+    /// Options of `YoloV7::detect_tiled`
+    struct TileOptions {
+        int tile_size = 640;            // tile side in image pixels, every tile is letterboxed to the target size
+        int overlap = 128;              // pixels shared by neighbouring tiles, should exceed the small objects of interest
+        int num_threads = 1;            // tiles detected in parallel, one extractor per thread
+        bool full_frame = true;         // also detect on the whole downscaled frame, for objects larger than a tile
+        float seam_threshold = 0.6f;    // share of a box cut by a seam covered by another box to merge them
+    };
+
+    /// CPU threading of the inference, see `YoloV7::set_threading`
+    struct ThreadOptions {
+        int num_threads = 1;            // OpenMP threads per inference, at most get_physical_cpu_count()
+        int powersave = 0;              // 0 = all cores, 1 = little cores only, 2 = big cores only
+        ncnn::CpuSet affinity;          // cores the inference threads are pinned to, overrides powersave if not empty
+    };
+
+    /// Bounds of the non-maximum suppression, see `YoloV7::set_detection_limits`
+    struct DetectionLimits {
+        int max_candidates = 30000;     // most probable proposals that are sorted and suppressed, 0 for all
+        int max_detections = 300;       // objects reported per frame, 0 for all
+    };
+
+    /// What `YoloV7::detect_async` does with a frame when the queue is full
+    enum class OverloadPolicy {
+        Block,                          // wait until a worker takes a frame
+        Reject,                         // fail the new frame
+        DropOldest                      // fail the oldest queued frame and queue the new one
+    };
+
+    /// Worker pool and queue of `YoloV7::detect_async`
+    struct AsyncOptions {
+        int num_workers = 1;            // detections running at the same time, each with `ThreadOptions::num_threads`
+        int queue_size = 2;             // frames waiting for a worker
+        OverloadPolicy overload = OverloadPolicy::Block;
+    };
+
+    /// Counters of `YoloV7::detect_async` since the workers were started, times in ms
+    struct AsyncStats {
+        size_t submitted{};
+        size_t started{};               // taken from the queue by a worker
+        size_t completed{};
+        size_t rejected{};
+        size_t dropped{};
+        int queue_depth{};              // frames waiting right now
+        int max_queue_depth{};
+        double avg_wait{};              // time from submission until a worker takes the frame
+        double max_wait{};
+    };
+
+    class DetectQueue;
+
+    /// Loaded network and everything that must stay alive while an Extractor of it runs
+    struct Model {
+        // declared before the network, referenced weights must outlive it
+        MmapDataReader weights_reader;
+        Bundle bundle;
+        std::vector<unsigned char> sliced_weights;      // weights of a class subset, referenced by the network
+        std::vector<SparseHeadConvolution*> heads;     // convolutions of the network if sparse heads are enabled, owned by it
+        ncnn::Net net;
+        int input_index{};
+        std::vector<int> output_indexes;
+        StartupTimes times;
+        float input_norm = 1 / 255.f;   // scale of the input pixels, 1 if folded into the first convolution
+        std::vector<int> class_ids;     // original class of each output class if the heads were sliced
+        bool sparse_heads{};            // head outputs are only defined for cells that can reach sparse_threshold
+        float sparse_threshold{};       // probability threshold the sparse heads were set up for
+    };
+
+    /// One detection split into stages that can run on different threads,
+    /// see `YoloV7::preprocess`, `YoloV7::infer` and `YoloV7::postprocess`
+    struct DetectionState {
+        std::shared_ptr<Model> model;       // network the detection started on, kept across a swap
+        Letterbox lb;
+        ncnn::Mat in;                       // reused by the next detection with the same state
+        std::vector<ncnn::Mat> outputs;
+    };
+
     class YoloV7 {
     public:
         /// @brief Constructor
@@ -40,18 +140,236 @@ namespace Yolo {
                         const char* path_to_param = "../resources/yolov7_tiny.torchscript.ncnn.param",
                         const char* path_to_bin = "../resources/yolov7_tiny.torchscript.ncnn.bin");
 
+        /// @brief Constructor for a model bundle, all settings are taken from the bundle by `init`
+        /// @param path_to_bundle Path to the bundle file created by `ncnn_yolov7_bundle`
+        explicit YoloV7(const char* path_to_bundle);
+
+        /// @brief Constructor for a model bundle in memory, e.g. embedded into the executable
+        /// @param bundle_data Start of the bundle, must stay valid for the lifetime of the object
+        /// @param bundle_size Size of the bundle in bytes
+        YoloV7(const unsigned char* bundle_data, size_t bundle_size);
+
+        /// @brief Destructor, detects the frames still queued by `detect_async` first
+        ~YoloV7();
+
+        /// @brief Loads the network from the param and bin file or the bundle, must be called once before `detect`
+        /// @param use_mmap Memory map the bin file and reference the weights instead of copying them to the heap,
+        /// bundles are always memory mapped
+        /// @return `0` on success, `-1` if the model could not be loaded
+        int init(bool use_mmap = true);
+
+        /// @brief Uses the network of another detector instead of loading one, e.g. to run the same weights at another target size
+        ///
+        /// A bundle detector takes over all settings of the other detector, as `init` would take them from the bundle.
+        /// Detectors of param and bin files keep their own target size and thresholds.
+        /// @param other Initialized detector with the same model source, see `model_source`
+        /// @return `0` on success, `-1` if the other detector is not initialized, has another model source
+        /// or, for param and bin files, other blob names, classes, strides or anchors, or if its sparse heads were set
+        /// up for another probability threshold, see `set_sparse_heads`
+        int share_model(const YoloV7 &other);
+
+        /// @brief Identifies the model files, detectors with equal sources can share one network
+        /// @return Real paths of the param and bin file, of the bundle file, or the address of an in-memory bundle
+        std::string model_source() const;
+
+        /// @brief Sets the number of inference threads and the cores they run on
+        ///
+        /// The thread count applies to every following `detect`. Power saving policy and affinity
+        /// are set with ncnn's `set_cpu_powersave` and `set_cpu_thread_affinity`, which pin the
+        /// OpenMP threads of the calling thread, so they are applied by each thread on its next `detect`.
+        /// Must not be called while `detect` runs.
+        /// @param options Thread count, power saving policy and affinity
+        /// @return `0` on success, `-1` if the thread count exceeds the physical cores or the cores do not exist
+        int set_threading(const ThreadOptions &options);
+
+        /// @brief Thread count, power saving policy and affinity set with `set_threading`
+        ThreadOptions threading_options() const;
+
+        /// @brief Folds the 1/255 input normalization into the first convolution's weights when the network
+        /// is loaded, the letterboxed pixels are then fed unscaled. Applies to every later `init` and `swap_model`,
+        /// models whose first layer is not a convolution on the input are loaded unchanged.
+        /// @param enable `true` to fold the normalization
+        void set_fold_input_normalization(bool enable);
+
+        /// @brief Evaluates the box and class channels of the detection heads only for cells whose objectness
+        /// can reach the probability threshold, the objectness channels are still computed for every cell.
+        /// Applies to every later `init` and `swap_model`, heads that are not float 1x1 convolutions with
+        /// `3 * (5 + num_classes)` outputs are evaluated densely.
+        /// @param enable `true` to evaluate the heads sparsely
+        void set_sparse_heads(bool enable);
+
+        /// @brief Cells, candidates and multiply-accumulates of the sparse heads of the current model
+        SparseHeadStats sparse_head_stats() const;
+
+        /// @brief Bounds the proposals that enter the non-maximum suppression and the objects it reports
+        ///
+        /// Only the `max_candidates` most probable proposals are selected and sorted, the suppression
+        /// stops after `max_detections` objects. Must not be called while `detect` runs.
+        /// @param limits Candidate and detection caps, `0` disables a cap
+        /// @return `0` on success, `-1` if a cap is negative
+        int set_detection_limits(const DetectionLimits &limits);
+
+        /// @brief Specializes the model to a subset of its classes when the param and bin files are loaded
+        ///
+        /// The detection heads are sliced to the box, objectness and kept class channels, see `slice_class_subset`,
+        /// so they compute and decode `3 * (5 + k)` instead of `3 * (5 + num_classes)` channels. Detected objects keep
+        /// their original labels. Applies to every later `init` and `swap_model`,
+        /// bundles must be specialized with `ncnn_yolov7_subset` before they are packed.
+        /// @param class_ids Classes to keep, empty for all
+        /// @return `0` on success, `-1` if an id is repeated or not below `num_classes`
+        int set_class_subset(const std::vector<int> &class_ids);
+
+        /// @brief Sets the allocators of the extractors created by `detect`, `nullptr` for ncnn's default allocation
+        /// @param blob_allocator Allocator for the layer outputs, must be thread safe if `detect` runs concurrently
+        /// @param workspace_allocator Allocator for temporary layer buffers, same rules as for blobs
+        void set_allocators(ncnn::Allocator* blob_allocator,
+                            ncnn::Allocator* workspace_allocator);
+
+        /// @brief Configures the pool allocators every detection worker keeps for its extractors
+        ///
+        /// Unless `set_allocators` was used, each detection running at the same time gets its own
+        /// blob and workspace pool for its input shape, which keep the buffers of the last frame, so
+        /// after the first frames an inference no longer allocates. Must not be called while `detect`
+        /// runs or a `DetectionState` holds outputs, the previous pools and their counters are released.
+        /// @param options Size compare ratio and drop threshold of the pools, or `enabled = false` for ncnn's default allocation
+        /// @return `0` on success, `-1` if the ratio is outside 0 ~ 1
+        int set_pool_options(const PoolOptions &options);
+
+        /// @brief Requests and actual allocations of the worker pools, see `set_pool_options`
+        AllocatorStats allocator_stats() const;
+
+        /// @brief Runs dummy inferences to fault in weights and grow the allocator pools before real frames arrive
+        /// @param n Number of inferences, the first is reported as first inference, the others as steady state
+        /// @param w Width of the dummy frame, `0` for the target size
+        /// @param h Height of the dummy frame, `0` for the target size
+        /// @return `0` on success, `-1` if the network is not initialized
+        int warmup(int n = 3, int w = 0, int h = 0);
+
+        /// @brief Durations of the startup phases of the current model
+        StartupTimes startup_times() const;
+
+        /// @brief Loads a new param and bin file into a second network, warms it up and switches `detect` over to it
+        ///
+        /// Detections running during the swap finish on the old network, which is released
+        /// once the last of them returns. The anchors, strides and blob names must match.
+        /// @param path_to_param Path to the new ncnn model param file
+        /// @param path_to_bin Path to the new ncnn model bin file
+        /// @param warmup_runs Number of warmup inferences on the new network before the switch
+        /// @return `0` on success, `-1` if the new model could not be loaded, the current model is kept then
+        int swap_model(const char* path_to_param,
+                       const char* path_to_bin,
+                       int warmup_runs = 1);
+
+        /// @brief Runs `swap_model` on a background thread
+        /// @return Future with the result of `swap_model`
+        std::future<int> swap_model_async(const std::string &path_to_param,
+                                          const std::string &path_to_bin,
+                                          int warmup_runs = 1);
+
+        /// @brief Letterboxes every frame into the smallest fitting one of a fixed set of input shapes
+        /// instead of padding it to the next multiple of the stride
+        ///
+        /// Frames of different aspect ratios then share a few input shapes, each with its own input
+        /// buffers and, unless `set_allocators` was used, its own worker pools. Must not be called
+        /// while `detect` runs.
+        /// @param shapes Width and height of the input shapes, e.g. {640, 384}, {640, 480} and {640, 640},
+        /// frames that fit into none are padded as before, empty to disable the buckets
+        /// @return `0` on success, `-1` if a shape is not a multiple of the largest stride
+        int set_input_buckets(const std::vector<std::pair<int, int>> &shapes);
+
+        /// @brief Checks whether the network has been loaded by `init`
+        /// @return `true` if `detect` can be called
+        bool is_initialized() const;
+
         /// @brief Performs inference on an image
         /// @param bgr Input image in BGR format
         /// @param objects Vector of predicted object detections
-        void detect(const cv::Mat &bgr,
+        /// @return `0` on success, `-1` if the network is not initialized
+        int detect(const cv::Mat &bgr,
                    std::vector<Object> &objects);
 
+        /// @brief Queues an image for detection on the worker threads and returns immediately,
+        /// the workers are started with the options of `set_async_options` on the first call
+        /// @param bgr Input image in BGR format, referenced until the future is ready, so a reused
+        /// capture buffer must be cloned
+        /// @return Future of the detections, `get` throws `std::runtime_error` if the frame was
+        /// rejected or dropped by the overload policy or the detection failed
+        std::future<std::vector<Object>> detect_async(const cv::Mat &bgr);
+
+        /// @brief Sets the worker pool and queue of `detect_async`, running workers finish the queued
+        /// frames and are replaced on the next call. Must not be called while `detect_async` runs.
+        /// @param options Number of workers, queue size and overload policy
+        /// @return `0` on success, `-1` if the number of workers or the queue size is below 1
+        int set_async_options(const AsyncOptions &options);
+
+        /// @brief Queue depth, wait times and dropped frames of `detect_async`
+        AsyncStats async_stats() const;
+
+        /// @brief First stage of `detect`, letterboxes the image into the network input
+        /// @param bgr Input image in BGR format
+        /// @param state Detection state, its input buffer is reused
+        /// @return `0` on success, `-1` if the network is not initialized
+        int preprocess(const cv::Mat &bgr,
+                       DetectionState &state);
+
+        /// @brief Second stage of `detect`, runs the network on the preprocessed input
+        /// @param state Detection state filled by `preprocess`
+        /// @return `0` on success, `-1` if the state holds no input or the network fails
+        int infer(DetectionState &state);
+
+        /// @brief Last stage of `detect`, decodes the network outputs, applies NMS and maps the boxes back
+        /// @param state Detection state filled by `infer`
+        /// @param objects Vector of predicted object detections
+        /// @return `0` on success, `-1` if the state holds no outputs or was already postprocessed
+        int postprocess(DetectionState &state,
+                        std::vector<Object> &objects);
+
+        /// @brief Performs inference on overlapping tiles of a high resolution image, so that small objects
+        /// keep their size instead of being downscaled with the whole image
+        /// @param bgr Input image in BGR format
+        /// @param objects Vector of predicted object detections, duplicates at tile seams are merged
+        /// @param options Tile size, overlap and number of threads
+        /// @return `0` on success, `-1` if the network is not initialized or the options are invalid
+        int detect_tiled(const cv::Mat &bgr,
+                         std::vector<Object> &objects,
+                         const TileOptions &options = TileOptions());
+
+        /// @brief Performs inference on an image decoded at a reduced size, see `load_image`
+        /// @param image Decoded image and the size of the original
+        /// @param objects Vector of predicted object detections, in original image coordinates
+        /// @return `0` on success, `-1` if the network is not initialized
+        int detect(const ScaledImage &image,
+                   std::vector<Object> &objects);
+
+        /// @brief Loads an image for `detect`, large JPEGs are decoded straight at a size close to the input size
+        /// @param path Path to the image file
+        /// @param image Decoded image and the size of the original
+        /// @return `0` on success, `-1` if the image cannot be read
+        int load_image(const char* path,
+                       ScaledImage &image) const;
+
+        /// @brief Performs inference on a YUV420sp camera frame without converting it to a BGR image first
+        /// @param yuv420sp Y plane followed by the interleaved chroma plane
+        /// @param w Frame width, must be even
+        /// @param h Frame height, must be even
+        /// @param objects Vector of predicted object detections, in frame coordinates
+        /// @param nv21 `false` for NV12 (U before V), `true` for NV21 (V before U)
+        /// @return `0` on success, `-1` if the network is not initialized or the frame size is odd
+        int detect_yuv420sp(const unsigned char* yuv420sp,
+                            int w,
+                            int h,
+                            std::vector<Object> &objects,
+                            bool nv21 = false);
+
         /// @brief Creates the output image with bounding boxes
         /// @param bgr Input image in BGR format
         /// @param objects Predictions from the inference
         void draw_objects(const cv::Mat &bgr, 
                           const std::vector<Object> &objects);
 
+        /// @brief Class labels of the 80 COCO classes
+        static const std::vector<std::string>& coco_class_names();
+
         /// @brief Writes the predictions to a `.txt` file
         /// \param objects Predicted object detections
         /// \param filename Name of the image file
@@ -66,34 +384,115 @@ namespace Yolo {
         std::vector<float> anchors;
         const char* path_to_param;
         const char* path_to_bin;
+        const char* path_to_bundle{};
+        const unsigned char* bundle_data{};
+        size_t bundle_size{};
+        std::vector<std::string> class_names;
 
-        inline float intersection_area(const Object &a, 
-                                       const Object &b);
+        // blob names are only used with text params, the network is always addressed by blob index
+        std::string input_name = "in0";
+        std::vector<std::string> output_names = {"out0", "out1", "out2"};
+        std::vector<int> strides = {8, 16, 32};
+
+        bool fold_input_norm{};
+        bool sparse_heads{};
+        std::vector<int> class_subset;
+        DetectionLimits limits;
+        ThreadOptions threading;
+        int threading_version{};
+        ncnn::Allocator* blob_allocator{};
+        ncnn::Allocator* workspace_allocator{};
+
+        // canonical input shapes, see set_input_buckets
+        struct InputBucket {
+            int w;
+            int h;
+        };
+        std::vector<InputBucket> buckets;
+
+        // allocator pairs of the detection workers, see set_pool_options
+        std::unique_ptr<WorkerAllocatorPool> worker_pools;
+
+        AsyncOptions async_options;
+        mutable std::mutex async_mutex;
+
+        // swapped as a whole, every detection holds a reference to the model it started on
+        std::shared_ptr<Model> model;
+        mutable std::mutex model_mutex;
 
-        void qsort_descent_inplace(std::vector<Object> &objects, 
-                                   int left, 
-                                   int right);
+        // started by the first detect_async, declared last so its workers stop before the members they use
+        std::unique_ptr<DetectQueue> async_queue;
 
-        void qsort_descent_inplace(std::vector<Object> &objects);
+        std::shared_ptr<Model> current_model() const;
+
+        void set_model(const std::shared_ptr<Model> &next);
+
+        inline float intersection_area(const Object &a, 
+                                       const Object &b);
 
         void nms_sorted_bboxes(const std::vector<Object> &faceobjects, 
                                std::vector<int> &picked,
+                               int max_picked = 0,
                                bool agnostic = false);
 
-        static inline float sigmoid(float x);
+        void configure(Model &m) const;
+
+        int load_files(Model &m,
+                       const char* path_to_param,
+                       const char* path_to_bin,
+                       bool use_mmap);
+
+        int load_class_subset(Model &m,
+                              const char* path_to_param,
+                              const char* path_to_bin);
+
+        int load_bundle(Model &m,
+                        const char* name);
+
+        int load_weights(Model &m,
+                         const ncnn::DataReader &dr);
+
+        int resolve_blob_indexes(Model &m);
+
+        int enable_sparse_heads(Model &m) const;
+
+        int detect(Model &m,
+                   const cv::Mat &bgr,
+                   std::vector<Object> &objects);
+
+        int fit_bucket(Letterbox &lb) const;
+
+        void apply_threading() const;
+
+        static ncnn::Mat& input_buffer(int slot);
+
+        int detect(Model &m,
+                   const Letterbox &lb,
+                   const ncnn::Mat &in_pad,
+                   std::vector<Object> &objects);
+
+        int warmup(Model &m,
+                   int n,
+                   int w,
+                   int h);
+
+        int infer(Model &m,
+                  const ncnn::Mat &in_pad,
+                  std::vector<ncnn::Mat> &outputs);
+
+        int model_classes(const Model &m) const;
 
-        void extract_proposals(ncnn::Extractor &ex, 
-                               const char* output_name,
-                               int anchor_idx,
-                               int stride,
-                               const ncnn::Mat &in_pad, 
-                               std::vector<Object> &objects,
-                               double *inference_time);
+        void postprocess(const Model &m,
+                         const Letterbox &lb,
+                         const ncnn::Mat &in_pad,
+                         const std::vector<ncnn::Mat> &outputs,
+                         std::vector<Object> &objects);
 
         void generate_proposals(const ncnn::Mat &anchors, 
                                 int stride, 
                                 const ncnn::Mat &in_pad, 
                                 const ncnn::Mat &feat_blob,
+                                int num_classes,
                                 std::vector<Object> &objects);
     };
 }
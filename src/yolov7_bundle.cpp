@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bundle.h"
+#include "YoloV7.h"
+
+using namespace Yolo;
+
+static int read_file(const char* path, std::vector<unsigned char>& out)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    out.resize(size > 0 ? size : 0);
+    bool ok = size > 0 && fread(out.data(), 1, out.size(), fp) == out.size();
+    fclose(fp);
+
+    if (!ok)
+    {
+        fprintf(stderr, "fread %s failed\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int read_labels(const char* path, std::vector<std::string>& labels)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0')
+            labels.emplace_back(line);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 4 && argc != 5)
+    {
+        fprintf(stderr, "Usage: %s [parampath] [binpath] [bundlepath] [labelspath]\n", argv[0]);
+        fprintf(stderr, "Packs an ncnn model with the default yolov7 configuration into a bundle,\n");
+        fprintf(stderr, "labelspath holds one class label per line and defaults to the 80 COCO classes\n");
+        return -1;
+    }
+
+    std::vector<unsigned char> param;
+    std::map<std::string, int> blob_indexes;
+    if (Bundle::convert_param(argv[1], param, blob_indexes))
+        return -1;
+
+    std::vector<unsigned char> model;
+    if (read_file(argv[2], model))
+        return -1;
+
+    std::vector<std::string> labels = YoloV7::coco_class_names();
+    if (argc == 5)
+    {
+        labels.clear();
+        if (read_labels(argv[4], labels))
+            return -1;
+    }
+
+    // same configuration as the defaults of YoloV7 and main.cpp
+    const char* input_name = "in0";
+    const char* output_names[] = {"out0", "out1", "out2"};
+    const int strides[] = {8, 16, 32};
+    const float anchors[] = {12, 16, 19, 36, 40, 28, 36, 75, 76, 55, 72, 146, 142, 110, 192, 243, 459, 401};
+
+    BundleConfig config;
+    memset(&config, 0, sizeof(config));
+    config.target_size = 640;
+    config.num_classes = (int)labels.size();
+    config.prob_threshold = 0.25f;
+    config.nms_threshold = 0.5f;
+    config.num_outputs = 3;
+    config.input_index = blob_indexes.count(input_name) ? blob_indexes[input_name] : -1;
+    snprintf(config.input_name, BUNDLE_MAX_NAME, "%s", input_name);
+
+    if (config.input_index < 0)
+    {
+        fprintf(stderr, "%s has no input blob %s\n", argv[1], input_name);
+        return -1;
+    }
+
+    for (int i = 0; i < config.num_outputs; i++)
+    {
+        if (!blob_indexes.count(output_names[i]))
+        {
+            fprintf(stderr, "%s has no output blob %s\n", argv[1], output_names[i]);
+            return -1;
+        }
+
+        config.output_indexes[i] = blob_indexes[output_names[i]];
+        config.strides[i] = strides[i];
+        snprintf(config.output_names[i], BUNDLE_MAX_NAME, "%s", output_names[i]);
+    }
+    memcpy(config.anchors, anchors, sizeof(anchors));
+
+    if (Bundle::write(argv[3], param, model, config, labels))
+        return -1;
+
+    fprintf(stderr, "Bundle saved in %s (param %d bytes, weights %d bytes, %d labels)\n", argv[3],
+            (int)param.size(), (int)model.size(), (int)labels.size());
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// (C) 2024 Vassilij Nadarajah, TU Berlin
+// nadarajah@campus.tu-berlin.de
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "class_subset.h"
+#include "YoloV7.h"
+
+using namespace Yolo;
+
+static int write_file(const char* path, const void* data, size_t size)
+{
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "fopen %s failed\n", path);
+        return -1;
+    }
+
+    bool ok = fwrite(data, 1, size, fp) == size;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok)
+    {
+        fprintf(stderr, "fwrite %s failed\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 6 && argc != 7)
+    {
+        fprintf(stderr, "Usage: %s [parampath] [binpath] [classids] [outparampath] [outbinpath] [outlabelspath]\n", argv[0]);
+        fprintf(stderr, "Slices the detection heads of a yolov7 model with the 80 COCO classes down to the comma separated\n");
+        fprintf(stderr, "class ids, e.g. 0,2,16 for person, car and dog. outlabelspath receives their labels for ncnn_yolov7_bundle\n");
+        return -1;
+    }
+
+    ClassSubset subset;
+    if (parse_class_ids(argv[3], subset.class_ids) || check_class_ids(subset.class_ids, subset.num_classes))
+        return -1;
+
+    std::string param;
+    std::vector<unsigned char> model;
+    std::vector<SlicedHead> heads;
+    if (slice_class_subset_files(subset, argv[1], argv[2], param, model, &heads))
+        return -1;
+
+    if (write_file(argv[4], param.data(), param.size()) || write_file(argv[5], model.data(), model.size()))
+        return -1;
+
+    const std::vector<std::string>& names = YoloV7::coco_class_names();
+    if (argc == 7)
+    {
+        std::string labels;
+        for (int id : subset.class_ids)
+            labels += names[id] + "\n";
+
+        if (write_file(argv[6], labels.data(), labels.size()))
+            return -1;
+    }
+
+    for (const SlicedHead& head : heads)
+    {
+        fprintf(stderr, "%s -> %s: %d -> %d outputs, %d -> %d MACs per cell\n", head.name.c_str(), head.top.c_str(),
+                head.num_output, head.sliced_num_output, head.num_output * head.num_input, head.sliced_num_output * head.num_input);
+    }
+
+    // a plain YoloV7 would label the classes with the first COCO names, the bundle carries the right ones
+    fprintf(stderr, "Model with %d classes saved in %s and %s, pack it with ncnn_yolov7_bundle and these labels in order:\n",
+            (int)subset.class_ids.size(), argv[4], argv[5]);
+    for (size_t i = 0; i < subset.class_ids.size(); i++)
+        fprintf(stderr, "  %zu: %s\n", i, names[subset.class_ids[i]].c_str());
+
+    return 0;
+}